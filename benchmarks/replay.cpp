@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <lsp/connection.h>
+#include <lsp/process.h>
+#include <lsp/io/messageframe.h>
+#include <lsp/io/recording.h>
+#include <lsp/io/socket.h>
+
+#ifdef _WIN32
+	#include <WinSock2.h>
+#else
+	#include <sys/socket.h>
+#endif
+
+/*
+ * Replays a recording created with lsp::io::RecordingStream against a language server and reports
+ * the throughput and per-method response latency percentiles.
+ * The messages the recorded server received are sent to the server again, either with the original
+ * timing or as fast as possible. Responses are matched to requests by their id.
+ *
+ *     $ LspReplay --recording=<file> [--max-speed] [--timeout=<seconds>] --exe=<server_executable> <args>
+ *     $ LspReplay --recording=<file> [--max-speed] [--timeout=<seconds>] --port=<portnum>
+ *
+ * Use --replay-outgoing if the recording was made by a client instead.
+ */
+
+namespace{
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Messages to replay
+ */
+
+struct ReplayMessage{
+	std::chrono::nanoseconds timestamp;
+	std::string_view         data;
+	std::string              requestId; // Serialized id or empty if the message is not a request
+	std::string              method;
+};
+
+std::vector<ReplayMessage> replayMessages(const lsp::io::Recording& recording, lsp::io::MessageDirection direction)
+{
+	auto messages = std::vector<ReplayMessage>();
+
+	for(const auto& recorded : recording.messages())
+	{
+		if(recorded.direction != direction)
+			continue;
+
+		auto message = ReplayMessage{
+			.timestamp = recorded.timestamp,
+			.data      = recorded.data,
+			.requestId = {},
+			.method    = {}
+		};
+
+		if(const auto frame = lsp::io::findMessageFrame(recorded.data))
+		{
+			try
+			{
+				const auto json = lsp::json::parse(recorded.data.substr(frame->headerSize, frame->contentLength));
+
+				if(json.isObject())
+				{
+					const auto* id     = json.object().find("id");
+					const auto* method = json.object().find("method");
+
+					if(id && !id->isNull() && method && method->isString())
+					{
+						message.requestId = lsp::json::stringify(*id);
+						message.method    = method->string();
+					}
+				}
+			}
+			catch(const lsp::json::ParseError&)
+			{
+				// Replayed as is
+			}
+		}
+
+		messages.push_back(std::move(message));
+	}
+
+	return messages;
+}
+
+/*
+ * Replay
+ */
+
+class Replay{
+public:
+	Replay(lsp::io::Stream& stream)
+		: m_stream{stream}
+		, m_connection{stream}
+	{
+	}
+
+	void start()
+	{
+		m_reader = std::thread([this](){ readResponses(); });
+	}
+
+	// Closing the transport must make the reader thread return
+	template<typename F>
+	void finish(F&& closeTransport)
+	{
+		closeTransport();
+
+		if(m_reader.joinable())
+			m_reader.join();
+	}
+
+	void send(const std::vector<ReplayMessage>& messages, bool maxSpeed)
+	{
+		m_start = Clock::now();
+
+		for(const auto& message : messages)
+		{
+			if(!maxSpeed)
+				std::this_thread::sleep_until(m_start + (message.timestamp - messages.front().timestamp));
+
+			if(!message.requestId.empty())
+			{
+				const auto lock = std::lock_guard(m_mutex);
+				m_pendingRequests[message.requestId] = {message.method, Clock::now()};
+			}
+
+			m_stream.write(message.data.data(), message.data.size());
+			m_bytesSent += message.data.size();
+		}
+
+		const auto lock = std::lock_guard(m_mutex);
+		m_end = std::max(m_end, Clock::now());
+	}
+
+	// Returns false if there still were unanswered requests after the timeout
+	bool waitForResponses(std::chrono::seconds timeout)
+	{
+		auto lock = std::unique_lock(m_mutex);
+		return m_responseReceived.wait_for(lock, timeout, [this](){ return m_pendingRequests.empty() || m_readerDone; }) &&
+		       m_pendingRequests.empty();
+	}
+
+	void printReport(std::size_t messageCount) const
+	{
+		const auto lock      = std::lock_guard(m_mutex);
+		const auto seconds   = std::chrono::duration<double>(m_end - m_start).count();
+		const auto megabytes = static_cast<double>(m_bytesSent) / (1024.0 * 1024.0);
+
+		std::cout << std::fixed << std::setprecision(2)
+		          << "Replayed " << messageCount << " messages (" << megabytes << " MiB) in " << seconds << " s: "
+		          << static_cast<double>(messageCount) / seconds << " msg/s, "
+		          << megabytes / seconds << " MiB/s" << std::endl;
+
+		if(!m_pendingRequests.empty())
+			std::cout << "Unanswered requests: " << m_pendingRequests.size() << std::endl;
+
+		std::cout << '\n' << std::left << std::setw(40) << "method" << std::right
+		          << std::setw(8) << "count"
+		          << std::setw(10) << "p50"
+		          << std::setw(10) << "p90"
+		          << std::setw(10) << "p99"
+		          << std::setw(10) << "max" << "  (ms)" << std::endl;
+
+		for(auto [method, latencies] : m_latencies)
+		{
+			std::ranges::sort(latencies);
+
+			const auto percentile = [&latencies](double p)
+			{
+				const auto rank = static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1) + 0.5);
+				return latencies[rank];
+			};
+
+			std::cout << std::left << std::setw(40) << method << std::right
+			          << std::setw(8) << latencies.size()
+			          << std::setw(10) << percentile(0.5)
+			          << std::setw(10) << percentile(0.9)
+			          << std::setw(10) << percentile(0.99)
+			          << std::setw(10) << latencies.back() << std::endl;
+		}
+	}
+
+private:
+	struct PendingRequest{
+		std::string       method;
+		Clock::time_point sendTime;
+	};
+
+	lsp::io::Stream&                                m_stream;
+	lsp::Connection                                 m_connection;
+	std::thread                                     m_reader;
+	mutable std::mutex                              m_mutex;
+	std::condition_variable                         m_responseReceived;
+	std::unordered_map<std::string, PendingRequest> m_pendingRequests;
+	std::map<std::string, std::vector<double>>      m_latencies;
+	Clock::time_point                               m_start;
+	Clock::time_point                               m_end;
+	std::size_t                                     m_bytesSent  = 0;
+	bool                                            m_readerDone = false;
+
+	void readResponses()
+	{
+		try
+		{
+			while(true)
+			{
+				auto message = m_connection.readMessage();
+
+				if(const auto* single = std::get_if<lsp::jsonrpc::Message>(&message))
+				{
+					handleMessage(*single);
+				}
+				else
+				{
+					for(const auto& batchMessage : std::get<lsp::jsonrpc::MessageBatch>(message))
+						handleMessage(batchMessage);
+				}
+			}
+		}
+		catch(const std::exception&)
+		{
+			// Connection closed
+		}
+
+		const auto lock = std::lock_guard(m_mutex);
+		m_readerDone = true;
+		m_responseReceived.notify_all();
+	}
+
+	void handleMessage(const lsp::jsonrpc::Message& message)
+	{
+		// Requests sent by the server are answered by the client responses contained in the recording
+		const auto* response = std::get_if<lsp::jsonrpc::Response>(&message);
+
+		if(!response)
+			return;
+
+		const auto now  = Clock::now();
+		const auto id   = std::visit([](auto v){ return lsp::json::stringify(lsp::json::Value(std::move(v))); }, response->id);
+		const auto lock = std::lock_guard(m_mutex);
+
+		if(const auto it = m_pendingRequests.find(id); it != m_pendingRequests.end())
+		{
+			const auto latency = std::chrono::duration<double, std::milli>(now - it->second.sendTime).count();
+			m_latencies[it->second.method].push_back(latency);
+			m_pendingRequests.erase(it);
+			m_end = std::max(m_end, now);
+			m_responseReceived.notify_all();
+		}
+	}
+};
+
+void shutdownSocket(lsp::io::Socket& socket)
+{
+	// Wakes up the reader thread that is blocked on the socket
+#ifdef _WIN32
+	::shutdown(socket.nativeHandle(), SD_BOTH);
+#else
+	::shutdown(socket.nativeHandle(), SHUT_RDWR);
+#endif
+}
+
+/*
+ * Argument parsing
+ */
+
+struct Args{
+	std::string                   recording;
+	bool                          maxSpeed       = false;
+	bool                          replayOutgoing = false;
+	std::chrono::seconds          timeout        = std::chrono::seconds(30);
+	std::optional<unsigned short> port;
+	std::string                   executable;
+	std::vector<std::string>      executableArgs;
+};
+
+template<typename T>
+std::optional<T> parseNumber(std::string_view str)
+{
+	T value;
+	const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+
+	if(ec != std::errc{} || ptr != str.data() + str.size())
+		return std::nullopt;
+
+	return value;
+}
+
+std::optional<Args> parseArgs(int argc, char** argv)
+{
+	constexpr auto RecordingArg      = std::string_view("--recording=");
+	constexpr auto MaxSpeedArg       = std::string_view("--max-speed");
+	constexpr auto ReplayOutgoingArg = std::string_view("--replay-outgoing");
+	constexpr auto TimeoutArg        = std::string_view("--timeout=");
+	constexpr auto PortArg           = std::string_view("--port=");
+	constexpr auto ExeArg            = std::string_view("--exe=");
+
+	auto args = Args();
+
+	for(int i = 1; i < argc; ++i)
+	{
+		const auto arg = std::string_view(argv[i]);
+
+		if(!args.executable.empty())
+		{
+			// Executable arg was found so add all remaning args to the command line
+			args.executableArgs.push_back(std::string(arg));
+		}
+		else if(arg.starts_with(RecordingArg))
+		{
+			args.recording = arg.substr(RecordingArg.size());
+		}
+		else if(arg == MaxSpeedArg)
+		{
+			args.maxSpeed = true;
+		}
+		else if(arg == ReplayOutgoingArg)
+		{
+			args.replayOutgoing = true;
+		}
+		else if(arg.starts_with(TimeoutArg))
+		{
+			const auto timeout = parseNumber<unsigned>(arg.substr(TimeoutArg.size()));
+
+			if(!timeout.has_value())
+			{
+				std::cerr << "Invalid timeout: " << arg.substr(TimeoutArg.size()) << std::endl;
+				return std::nullopt;
+			}
+
+			args.timeout = std::chrono::seconds(*timeout);
+		}
+		else if(arg.starts_with(PortArg))
+		{
+			args.port = parseNumber<unsigned short>(arg.substr(PortArg.size()));
+
+			if(!args.port.has_value())
+			{
+				std::cerr << "Invalid port: " << arg.substr(PortArg.size()) << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if(arg.starts_with(ExeArg))
+		{
+			args.executable = arg.substr(ExeArg.size());
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return std::nullopt;
+		}
+	}
+
+	if(args.recording.empty() || (args.executable.empty() && !args.port.has_value()))
+		return std::nullopt;
+
+	return args;
+}
+
+template<typename F>
+int runReplay(lsp::io::Stream& stream, const std::vector<ReplayMessage>& messages, const Args& args, F&& closeTransport)
+{
+	auto replay = Replay(stream);
+	replay.start();
+
+	try
+	{
+		replay.send(messages, args.maxSpeed);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+	}
+
+	if(!replay.waitForResponses(args.timeout))
+		std::cerr << "Not all requests were answered" << std::endl;
+
+	replay.finish(closeTransport);
+	replay.printReport(messages.size());
+
+	return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const auto args = parseArgs(argc, argv);
+
+	if(!args.has_value())
+	{
+		std::cerr << R"(Available arguments:
+    --recording=<file>        Recording created with lsp::io::RecordingStream
+    --max-speed               Send messages as fast as possible instead of using the recorded timing
+    --replay-outgoing         Replay the messages written by the recorded side instead of the ones it received
+    --timeout=<seconds>       Time to wait for outstanding responses after all messages were sent (default 30)
+    --port=<portnum>          Connect to a language server via socket on port <portnum>
+    --exe=<executable> <args> Launch language server <executable> and connect to it via stdio)" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		const auto recording = lsp::io::Recording(args->recording);
+		const auto direction = args->replayOutgoing ? lsp::io::MessageDirection::Outgoing : lsp::io::MessageDirection::Incoming;
+		const auto messages  = replayMessages(recording, direction);
+
+		if(messages.empty())
+		{
+			std::cerr << "The recording does not contain any messages to replay" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		if(!args->executable.empty())
+		{
+			auto process = lsp::Process(args->executable, args->executableArgs);
+			return runReplay(process.stdIO(), messages, *args, [&process](){ process.terminate(); });
+		}
+
+		auto socket = lsp::io::Socket::connect(lsp::io::Socket::Localhost, *args->port, lsp::io::SocketOptions::lowLatency());
+		return runReplay(socket, messages, *args, [&socket](){ shutdownSocket(socket); });
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <lsp/threadpool.h>
+
+/*
+ * Compares the throughput of lsp::ThreadPool with a pool that shares a single locked queue between all threads.
+ * Tiny tasks are either added by threads outside of the pool or spawned by tasks that are already running.
+ *
+ *     $ LspThreadPoolBenchmark [tasks per run]
+ */
+
+namespace{
+
+/*
+ * Pool with a single queue for comparison
+ */
+
+class LockedQueuePool{
+public:
+	explicit LockedQueuePool(unsigned int threadCount)
+	{
+		for(unsigned int i = 0; i < threadCount; ++i)
+			m_threads.emplace_back(&LockedQueuePool::run, this);
+	}
+
+	~LockedQueuePool()
+	{
+		waitUntilFinished();
+	}
+
+	void waitUntilFinished()
+	{
+		{
+			const auto lock = std::lock_guard(m_mutex);
+			m_running = false;
+		}
+
+		m_event.notify_all();
+
+		for(auto& t : m_threads)
+			t.join();
+
+		m_threads.clear();
+	}
+
+	template<typename F>
+	auto addTask(F&& f) -> std::future<std::invoke_result_t<F>>
+	{
+		auto task   = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(f));
+		auto future = task->get_future();
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+			m_tasks.emplace_back([task](){ (*task)(); });
+		}
+
+		m_event.notify_one();
+
+		return future;
+	}
+
+private:
+	std::deque<std::function<void()>> m_tasks;
+	std::vector<std::thread>          m_threads;
+	bool                              m_running = true;
+	std::mutex                        m_mutex;
+	std::condition_variable           m_event;
+
+	void run()
+	{
+		auto lock = std::unique_lock(m_mutex);
+
+		while(true)
+		{
+			m_event.wait(lock, [this](){ return !m_tasks.empty() || !m_running; });
+
+			if(m_tasks.empty())
+				break;
+
+			auto task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+			lock.unlock();
+			task();
+			lock.lock();
+		}
+	}
+};
+
+/*
+ * Benchmark
+ */
+
+std::atomic<std::size_t> g_sink = 0;
+
+void tinyTask()
+{
+	g_sink.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Tasks are added by threads outside of the pool
+template<typename Pool>
+double runExternal(Pool& pool, unsigned int producerCount, std::size_t taskCount)
+{
+	const auto start     = std::chrono::steady_clock::now();
+	auto       producers = std::vector<std::thread>();
+
+	for(unsigned int i = 0; i < producerCount; ++i)
+	{
+		producers.emplace_back([&pool, count = taskCount / producerCount]()
+		{
+			for(std::size_t j = 0; j < count; ++j)
+				pool.addTask(tinyTask);
+		});
+	}
+
+	for(auto& t : producers)
+		t.join();
+
+	pool.waitUntilFinished();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every task added from outside spawns more tasks from inside of the pool
+template<typename Pool>
+double runNested(Pool& pool, std::size_t taskCount)
+{
+	constexpr std::size_t ChildCount = 64;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for(std::size_t i = 0; i < taskCount / ChildCount; ++i)
+	{
+		pool.addTask([&pool]()
+		{
+			for(std::size_t j = 0; j < ChildCount - 1; ++j)
+				pool.addTask(tinyTask);
+		});
+	}
+
+	pool.waitUntilFinished();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printResult(const char* name, double seconds, std::size_t taskCount)
+{
+	std::cout << "  " << name << ": " << static_cast<double>(taskCount) / seconds << " tasks/s" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const std::size_t taskCount = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	const auto        maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	for(auto threadCount = 1u; threadCount <= maxThreads; threadCount *= 2)
+	{
+		for(const auto producerCount : {1u, 4u})
+		{
+			std::cout << threadCount << " threads, " << producerCount << " external producers:" << std::endl;
+
+			{
+				auto pool = lsp::ThreadPool(threadCount, threadCount);
+				printResult("work stealing", runExternal(pool, producerCount, taskCount), taskCount);
+			}
+
+			{
+				auto pool = LockedQueuePool(threadCount);
+				printResult("locked queue ", runExternal(pool, producerCount, taskCount), taskCount);
+			}
+		}
+
+		std::cout << threadCount << " threads, nested tasks:" << std::endl;
+
+		{
+			auto pool = lsp::ThreadPool(threadCount, threadCount);
+			printResult("work stealing", runNested(pool, taskCount), taskCount);
+		}
+
+		{
+			auto pool = LockedQueuePool(threadCount);
+			printResult("locked queue ", runNested(pool, taskCount), taskCount);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
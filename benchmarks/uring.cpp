@@ -0,0 +1,190 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <lsp/io/uring.h>
+
+/*
+ * Compares the message throughput of the regular read/write system call loops with the io_uring backend.
+ * Messages are framed like base protocol messages and read the same way lsp::Connection reads them:
+ * The header one byte at a time followed by the content.
+ *
+ *     $ LspUringBenchmark [messageCount]
+ */
+
+#ifdef LSP_URING_UNSUPPORTED
+
+int main()
+{
+	std::cerr << "io_uring is not supported on this platform" << std::endl;
+	return EXIT_FAILURE;
+}
+
+#else
+
+namespace{
+
+/*
+ * Backends
+ */
+
+class SyscallIO{
+public:
+	void read(int fd, char* buffer, std::size_t size)
+	{
+		while(size > 0)
+		{
+			const auto bytesRead = ::read(fd, buffer, size);
+
+			if(bytesRead <= 0)
+				throw lsp::io::Error("read failed");
+
+			buffer += bytesRead;
+			size -= static_cast<std::size_t>(bytesRead);
+		}
+	}
+
+	void write(int fd, const char* buffer, std::size_t size)
+	{
+		while(size > 0)
+		{
+			const auto bytesWritten = ::write(fd, buffer, size);
+
+			if(bytesWritten <= 0)
+				throw lsp::io::Error("write failed");
+
+			buffer += bytesWritten;
+			size -= static_cast<std::size_t>(bytesWritten);
+		}
+	}
+};
+
+class UringIO{
+public:
+	UringIO()
+		: m_ring{lsp::io::Uring::create()}
+	{
+		if(!m_ring)
+			throw lsp::io::Error("io_uring is not available");
+	}
+
+	void read(int fd, char* buffer, std::size_t size){ m_ring->read(fd, buffer, size); }
+	void write(int fd, const char* buffer, std::size_t size){ m_ring->write(fd, buffer, size); }
+
+private:
+	std::unique_ptr<lsp::io::Uring> m_ring;
+};
+
+/*
+ * Benchmark
+ */
+
+std::string makeMessage(std::size_t contentSize)
+{
+	return "Content-Length: " + std::to_string(contentSize) + "\r\n\r\n" + std::string(contentSize, 'x');
+}
+
+template<typename IO>
+double runBenchmark(int readFd, int writeFd, const std::string& message, std::size_t contentSize, std::size_t messageCount)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	auto writer = std::thread([&]()
+	{
+		auto io = IO();
+
+		for(std::size_t i = 0; i < messageCount; ++i)
+			io.write(writeFd, message.data(), message.size());
+	});
+
+	auto io      = IO();
+	auto content = std::string(contentSize, '\0');
+
+	for(std::size_t i = 0; i < messageCount; ++i)
+	{
+		auto headerEnd = 0;
+
+		while(headerEnd < 4)
+		{
+			char c;
+			io.read(readFd, &c, 1);
+			headerEnd = (c == "\r\n\r\n"[headerEnd]) ? headerEnd + 1 : 0;
+		}
+
+		io.read(readFd, content.data(), content.size());
+	}
+
+	writer.join();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printResult(const char* name, double seconds, std::size_t messageSize, std::size_t messageCount)
+{
+	const auto megabytes = static_cast<double>(messageSize * messageCount) / (1024.0 * 1024.0);
+	std::cout << "  " << name << ": "
+	          << static_cast<double>(messageCount) / seconds << " msg/s, "
+	          << megabytes / seconds << " MiB/s" << std::endl;
+}
+
+template<typename CreateFds>
+void compare(const char* transport, CreateFds&& createFds, std::size_t messageCount)
+{
+	for(const auto contentSize : {std::size_t(64), std::size_t(4096), std::size_t(256 * 1024)})
+	{
+		const auto message = makeMessage(contentSize);
+		std::cout << transport << ", " << contentSize << " byte content:" << std::endl;
+
+		int fds[2];
+
+		createFds(fds);
+		printResult("read/write", runBenchmark<SyscallIO>(fds[0], fds[1], message, contentSize, messageCount), message.size(), messageCount);
+		close(fds[0]);
+		close(fds[1]);
+
+		createFds(fds);
+		printResult("io_uring  ", runBenchmark<UringIO>(fds[0], fds[1], message, contentSize, messageCount), message.size(), messageCount);
+		close(fds[0]);
+		close(fds[1]);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const std::size_t messageCount = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+	if(!lsp::io::Uring::create())
+	{
+		std::cerr << "io_uring is not available on this system" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		compare("pipe", [](int* fds)
+		{
+			if(pipe(fds) != 0)
+				throw lsp::io::Error(std::strerror(errno));
+		}, messageCount);
+
+		compare("socket", [](int* fds)
+		{
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+				throw lsp::io::Error(std::strerror(errno));
+		}, messageCount);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#endif // LSP_URING_UNSUPPORTED
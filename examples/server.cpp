@@ -245,7 +245,8 @@ int runSocketServer(unsigned short port)
 	{
 		std::cerr << "Waiting for incoming connections..." << std::endl;
 
-		auto socketListener = lsp::io::SocketListener(port);
+		// Disable Nagle's algorithm so small responses like hover are sent without delay
+		auto socketListener = lsp::io::SocketListener(port, 32, lsp::io::SocketOptions::lowLatency());
 
 		while(socketListener.isReady())
 		{
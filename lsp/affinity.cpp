@@ -0,0 +1,230 @@
+#include <lsp/affinity.h>
+
+#ifdef __linux__
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <sched.h>
+#endif
+
+namespace lsp{
+
+#ifdef __linux__
+
+namespace{
+
+/*
+ * CPU topology as reported by sysfs
+ */
+
+struct CpuInfo{
+	unsigned int cpu;
+	unsigned int node;
+	unsigned int package;
+	unsigned int core;
+};
+
+std::optional<unsigned int> parseNumber(std::string_view str)
+{
+	auto value = 0u;
+
+	if(const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value); ec != std::errc{} || ptr == str.data())
+		return std::nullopt;
+
+	return value;
+}
+
+std::optional<unsigned int> readNumber(const std::filesystem::path& path)
+{
+	auto file = std::ifstream(path);
+	auto line = std::string();
+
+	if(!std::getline(file, line))
+		return std::nullopt;
+
+	return parseNumber(line);
+}
+
+// Parses lists like "0-3,8-11"
+std::vector<unsigned int> readCpuList(const std::filesystem::path& path)
+{
+	auto file = std::ifstream(path);
+	auto line = std::string();
+	auto cpus = std::vector<unsigned int>();
+
+	if(!std::getline(file, line))
+		return cpus;
+
+	auto list = std::string_view(line);
+
+	while(!list.empty())
+	{
+		const auto range = list.substr(0, list.find(','));
+		list.remove_prefix(std::min(range.size() + 1, list.size()));
+
+		const auto dash  = range.find('-');
+		const auto first = parseNumber(range.substr(0, dash));
+		const auto last  = dash == std::string_view::npos ? first : parseNumber(range.substr(dash + 1));
+
+		if(!first.has_value() || !last.has_value())
+			continue;
+
+		for(auto cpu = *first; cpu <= *last; ++cpu)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+std::vector<CpuInfo> readTopology()
+{
+	auto allowed = cpu_set_t();
+	CPU_ZERO(&allowed);
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return {};
+
+	// Machines without NUMA support don't have the node directory
+	auto nodes = std::map<unsigned int, unsigned int>();
+	auto ec    = std::error_code();
+
+	for(const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+	{
+		const auto name = entry.path().filename().string();
+
+		if(!name.starts_with("node"))
+			continue;
+
+		if(const auto node = parseNumber(std::string_view(name).substr(4)); node.has_value())
+		{
+			for(const auto cpu : readCpuList(entry.path() / "cpulist"))
+				nodes[cpu] = *node;
+		}
+	}
+
+	auto topology = std::vector<CpuInfo>();
+
+	for(unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if(!CPU_ISSET(cpu, &allowed))
+			continue;
+
+		const auto path = std::filesystem::path("/sys/devices/system/cpu") / ("cpu" + std::to_string(cpu)) / "topology";
+		const auto node = nodes.find(cpu);
+
+		topology.push_back({
+			.cpu     = cpu,
+			.node    = node != nodes.end() ? node->second : 0,
+			.package = readNumber(path / "physical_package_id").value_or(0),
+			.core    = readNumber(path / "core_id").value_or(cpu)
+		});
+	}
+
+	return topology;
+}
+
+std::vector<unsigned int> compactOrder(std::vector<CpuInfo> topology)
+{
+	// Hardware threads of the same core end up next to each other
+	std::ranges::sort(topology, {}, [](const CpuInfo& info){ return std::tuple(info.node, info.package, info.core, info.cpu); });
+
+	auto order = std::vector<unsigned int>();
+
+	for(const auto& info : topology)
+		order.push_back(info.cpu);
+
+	return order;
+}
+
+std::vector<unsigned int> scatterOrder(std::vector<CpuInfo> topology)
+{
+	std::ranges::sort(topology, {}, [](const CpuInfo& info){ return std::tuple(info.node, info.package, info.core, info.cpu); });
+
+	// Take one hardware thread of every core round robin from each node, then the next one of every core and so on
+	struct Placement{
+		unsigned int sibling;   // Index of the hardware thread within its core
+		unsigned int coreIndex; // Index of the core within its node
+		unsigned int node;
+		unsigned int cpu;
+	};
+
+	auto placements = std::vector<Placement>();
+	auto coreCounts = std::map<unsigned int, unsigned int>(); // Per node
+
+	for(std::size_t i = 0; i < topology.size(); ++i)
+	{
+		const auto& info      = topology[i];
+		const auto  sameCore  = i > 0 && topology[i - 1].node == info.node && topology[i - 1].package == info.package && topology[i - 1].core == info.core;
+		auto&       coreCount = coreCounts[info.node];
+
+		if(!sameCore)
+			++coreCount;
+
+		placements.push_back({
+			.sibling   = sameCore ? placements.back().sibling + 1 : 0,
+			.coreIndex = coreCount - 1,
+			.node      = info.node,
+			.cpu       = info.cpu
+		});
+	}
+
+	std::ranges::sort(placements, {}, [](const Placement& p){ return std::tuple(p.sibling, p.coreIndex, p.node); });
+
+	auto order = std::vector<unsigned int>();
+
+	for(const auto& placement : placements)
+		order.push_back(placement.cpu);
+
+	return order;
+}
+
+const std::vector<unsigned int>& cpuOrder(CpuAffinity::Policy policy)
+{
+	static const auto topology = readTopology();
+	static const auto compact  = compactOrder(topology);
+	static const auto scatter  = scatterOrder(topology);
+
+	return policy == CpuAffinity::Policy::Scatter ? scatter : compact;
+}
+
+} // namespace
+
+bool setThreadAffinity(const CpuAffinity& affinity, unsigned int threadIndex)
+{
+	if(affinity.policy == CpuAffinity::Policy::None)
+		return false;
+
+	const auto& cpus = affinity.policy == CpuAffinity::Policy::List ? affinity.cpus : cpuOrder(affinity.policy);
+
+	if(cpus.empty())
+		return false;
+
+	const auto cpu = cpus[threadIndex % cpus.size()];
+
+	if(cpu >= CPU_SETSIZE)
+		return false;
+
+	auto set = cpu_set_t();
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	// Applies to the calling thread only
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+bool setThreadAffinity([[maybe_unused]] const CpuAffinity& affinity, [[maybe_unused]] unsigned int threadIndex)
+{
+	return false;
+}
+
+#endif
+
+} // namespace lsp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+namespace lsp{
+
+/*
+ * Pinning policy for a group of threads.
+ * Compact fills the cores of one NUMA node before moving on to the next so that threads share caches.
+ * Scatter spreads the threads over the NUMA nodes and physical cores first and only uses the other
+ * hardware threads of a core once every core has a thread.
+ * List uses the given CPUs in order.
+ * With every policy the CPUs are reused from the beginning if there are more threads than CPUs.
+ */
+struct CpuAffinity{
+	enum class Policy{
+		None,
+		Compact,
+		Scatter,
+		List
+	};
+
+	Policy                    policy = Policy::None;
+	std::vector<unsigned int> cpus   = {}; // Only used with Policy::List
+};
+
+/*
+ * Pins the calling thread to the CPU the policy picks for the thread with the given index within its group.
+ * This can be used for threads that are not owned by the library, like the one that reads messages from a connection.
+ * Only the CPUs that the process was allowed to run on when a thread was first pinned are used.
+ * Returns false if the policy is None, the thread could not be pinned or pinning is not supported on the platform.
+ * Currently only Linux is supported.
+ */
+bool setThreadAffinity(const CpuAffinity& affinity, unsigned int threadIndex = 0);
+
+} // namespace lsp
@@ -0,0 +1,116 @@
+#include <bit>
+#include <lsp/bufferpool.h>
+
+namespace lsp{
+
+static_assert((BufferPool::MinPooledSize << 12) == BufferPool::MaxPooledSize);
+
+/*
+ * BufferPool::Buffer
+ */
+
+BufferPool::Buffer::Buffer(BufferPool* pool, std::unique_ptr<char[]> data, std::size_t size, std::size_t capacity)
+	: m_pool{pool}
+	, m_data{std::move(data)}
+	, m_size{size}
+	, m_capacity{capacity}
+{
+}
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+	: m_pool{other.m_pool}
+	, m_data{std::move(other.m_data)}
+	, m_size{other.m_size}
+	, m_capacity{other.m_capacity}
+{
+	other.m_pool     = nullptr;
+	other.m_size     = 0;
+	other.m_capacity = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+	if(this != &other)
+	{
+		release();
+		m_pool           = other.m_pool;
+		m_data           = std::move(other.m_data);
+		m_size           = other.m_size;
+		m_capacity       = other.m_capacity;
+		other.m_pool     = nullptr;
+		other.m_size     = 0;
+		other.m_capacity = 0;
+	}
+
+	return *this;
+}
+
+BufferPool::Buffer::~Buffer()
+{
+	release();
+}
+
+void BufferPool::Buffer::release()
+{
+	if(m_pool && m_data)
+		m_pool->release(std::move(m_data), m_capacity);
+
+	m_pool = nullptr;
+}
+
+/*
+ * BufferPool
+ */
+
+BufferPool::BufferPool()
+{
+	// Reserve up front so returning a buffer to the pool never allocates
+	for(auto& buffers : m_freeBuffers)
+		buffers.reserve(MaxBuffersPerClass);
+}
+
+BufferPool::Buffer BufferPool::acquire(std::size_t size)
+{
+	if(size > MaxPooledSize)
+		return Buffer(nullptr, std::make_unique_for_overwrite<char[]>(size), size, size);
+
+	const auto index    = sizeClass(size);
+	const auto capacity = MinPooledSize << index;
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		auto& buffers   = m_freeBuffers[index];
+
+		if(!buffers.empty())
+		{
+			auto data = std::move(buffers.back());
+			buffers.pop_back();
+			m_retainedBytes -= capacity;
+			return Buffer(this, std::move(data), size, capacity);
+		}
+	}
+
+	return Buffer(this, std::make_unique_for_overwrite<char[]>(capacity), size, capacity);
+}
+
+std::size_t BufferPool::sizeClass(std::size_t size)
+{
+	if(size <= MinPooledSize)
+		return 0;
+
+	return static_cast<std::size_t>(std::bit_width(size - 1)) - static_cast<std::size_t>(std::bit_width(MinPooledSize - 1));
+}
+
+void BufferPool::release(std::unique_ptr<char[]> data, std::size_t capacity)
+{
+	const auto lock = std::lock_guard(m_mutex);
+	auto& buffers   = m_freeBuffers[sizeClass(capacity)];
+
+	if(buffers.size() < MaxBuffersPerClass && m_retainedBytes + capacity <= MaxRetainedBytes)
+	{
+		buffers.push_back(std::move(data));
+		m_retainedBytes += capacity;
+	}
+}
+
+} // namespace lsp
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace lsp{
+
+/*
+ * Pool of reusable byte buffers that are grouped into power of two size classes.
+ * Acquired buffers are handed back to the pool when their handle is destroyed so that
+ * steady-state traffic with similarly sized messages does not allocate.
+ * Buffers above MaxPooledSize are allocated on demand and freed after use.
+ * A pool keeps at most MaxRetainedBytes of free buffers so a burst of large messages
+ * doesn't hold on to their memory for the lifetime of the connection.
+ */
+class BufferPool{
+public:
+	static constexpr std::size_t MinPooledSize        = 256;
+	static constexpr std::size_t MaxPooledSize        = 1024 * 1024;
+	static constexpr std::size_t MaxBuffersPerClass   = 4;
+	static constexpr std::size_t MaxRetainedBytes     = 2 * MaxPooledSize;
+
+	class Buffer{
+	public:
+		Buffer(Buffer&& other) noexcept;
+		Buffer& operator=(Buffer&& other) noexcept;
+		~Buffer();
+
+		[[nodiscard]] char* data(){ return m_data.get(); }
+		[[nodiscard]] const char* data() const{ return m_data.get(); }
+		[[nodiscard]] std::size_t size() const{ return m_size; }
+		[[nodiscard]] std::size_t capacity() const{ return m_capacity; }
+		[[nodiscard]] std::string_view view() const{ return {m_data.get(), m_size}; }
+
+	private:
+		friend class BufferPool;
+
+		BufferPool*             m_pool     = nullptr;
+		std::unique_ptr<char[]> m_data;
+		std::size_t             m_size     = 0;
+		std::size_t             m_capacity = 0;
+
+		Buffer(BufferPool* pool, std::unique_ptr<char[]> data, std::size_t size, std::size_t capacity);
+		void release();
+	};
+
+	BufferPool();
+
+	// The contents of the returned buffer are uninitialized
+	[[nodiscard]] Buffer acquire(std::size_t size);
+
+private:
+	static constexpr std::size_t SizeClassCount = 13; // MinPooledSize << 12 == MaxPooledSize
+
+	std::mutex                                                     m_mutex;
+	std::array<std::vector<std::unique_ptr<char[]>>, SizeClassCount> m_freeBuffers;
+	std::size_t                                                    m_retainedBytes = 0; // Capacity of the free buffers
+
+	static std::size_t sizeClass(std::size_t size);
+	void release(std::unique_ptr<char[]> data, std::size_t capacity);
+};
+
+} // namespace lsp
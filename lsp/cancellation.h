@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <lsp/error.h>
+
+namespace lsp{
+
+/*
+ * Token that is passed to request handlers in order to check whether a request was cancelled.
+ * Cancellation is cooperative: Long running handlers should check the token periodically and stop early.
+ * A default constructed token is never cancelled.
+ */
+class CancellationToken{
+public:
+	CancellationToken() = default;
+
+	[[nodiscard]] bool isCancelled() const{ return errorCode() != 0; }
+
+	// The error code the request should be answered with or 0 if it wasn't cancelled.
+	// Usually MessageError::RequestCancelled or MessageError::ContentModified if the request was superseded by a newer one.
+	[[nodiscard]] int errorCode() const{ return m_errorCode ? m_errorCode->load(std::memory_order_relaxed) : 0; }
+
+	// Throws a RequestError with the cancellation error code which is sent back as the response of the request
+	void throwIfCancelled() const
+	{
+		if(const auto code = errorCode(); code == MessageError::ContentModified)
+			throw RequestError(code, "Content modified");
+		else if(code != 0)
+			throw RequestError(code, "Request cancelled");
+	}
+
+private:
+	friend class CancellationSource;
+	std::shared_ptr<const std::atomic_int> m_errorCode;
+
+	explicit CancellationToken(std::shared_ptr<const std::atomic_int> errorCode)
+		: m_errorCode{std::move(errorCode)}
+	{
+	}
+};
+
+/*
+ * Creates tokens and cancels them
+ */
+class CancellationSource{
+public:
+	CancellationSource()
+		: m_errorCode{std::make_shared<std::atomic_int>(0)}
+	{
+	}
+
+	[[nodiscard]] CancellationToken token() const{ return CancellationToken(m_errorCode); }
+	[[nodiscard]] bool isCancelled() const{ return m_errorCode->load(std::memory_order_relaxed) != 0; }
+
+	// Only the first cancellation takes effect
+	void cancel(int errorCode = MessageError::RequestCancelled)
+	{
+		auto expected = 0;
+		m_errorCode->compare_exchange_strong(expected, errorCode, std::memory_order_relaxed);
+	}
+
+private:
+	std::shared_ptr<std::atomic_int> m_errorCode;
+};
+
+} // namespace lsp
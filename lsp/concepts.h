@@ -20,19 +20,27 @@ concept IsCallbackResult = std::invocable<F, P> && std::same_as<std::invoke_resu
 
 template<typename M, typename F>
 concept IsRequestCallbackResult = IsCallbackResult<typename M::Result, typename M::Params, F> ||
-                                  IsCallbackResult<AsyncRequestResult<M>, typename M::Params, F>;
+                                  IsCallbackResult<AsyncRequestResult<M>, typename M::Params, F> ||
+                                  IsCallbackResult<RequestPromise<M>, typename M::Params, F> ||
+                                  IsCallbackResult<RequestTask<M>, typename M::Params, F>;
 
 template<typename M, typename F>
 concept IsNoParamsRequestCallbackResult = IsNoParamsCallbackResult<typename M::Result, F> ||
-                                          IsNoParamsCallbackResult<AsyncRequestResult<M>, F>;
+                                          IsNoParamsCallbackResult<AsyncRequestResult<M>, F> ||
+                                          IsNoParamsCallbackResult<RequestPromise<M>, F> ||
+                                          IsNoParamsCallbackResult<RequestTask<M>, F>;
 
 template<typename M, typename F>
 concept IsNotificationCallbackResult = IsCallbackResult<void, typename M::Params, F> ||
-                                       IsCallbackResult<AsyncNotificationResult, typename M::Params, F>;
+                                       IsCallbackResult<AsyncNotificationResult, typename M::Params, F> ||
+                                       IsCallbackResult<NotificationPromise, typename M::Params, F> ||
+                                       IsCallbackResult<NotificationTask, typename M::Params, F>;
 
 template<typename M, typename F>
 concept IsNoParamsNotificationCallbackResult = IsNoParamsCallbackResult<void, F> ||
-                                               IsNoParamsCallbackResult<AsyncNotificationResult, F>;
+                                               IsNoParamsCallbackResult<AsyncNotificationResult, F> ||
+                                               IsNoParamsCallbackResult<NotificationPromise, F> ||
+                                               IsNoParamsCallbackResult<NotificationTask, F>;
 
 template<typename M, typename F>
 concept IsRequestCallback = message::HasParams<M> &&
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cctype>
 #include <charconv>
+#include <chrono>
 #include <cstring>
 #include <optional>
 #include <string_view>
@@ -9,6 +10,7 @@
 #include <lsp/error.h>
 #include <lsp/io/stream.h>
 #include <lsp/json/json.h>
+#include <lsp/tracing.h>
 
 #ifndef LSP_MESSAGE_DEBUG_LOG
 	#ifdef NDEBUG
@@ -30,6 +32,8 @@
 namespace lsp{
 namespace{
 
+using Clock = std::chrono::steady_clock;
+
 /*
  * Message logging
  */
@@ -83,6 +87,24 @@ void verifyContentType(std::string_view contentType)
 	}
 }
 
+/*
+ * Tracing
+ */
+
+// Batches are not tagged since their members can have different methods
+std::pair<std::string_view, const jsonrpc::MessageId*> traceTags(const Connection::Message& message)
+{
+	if(const auto* msg = std::get_if<jsonrpc::Message>(&message))
+	{
+		if(const auto* request = std::get_if<jsonrpc::Request>(msg))
+			return {request->method, request->id.has_value() ? &*request->id : nullptr};
+
+		return {{}, &std::get<jsonrpc::Response>(*msg).id};
+	}
+
+	return {};
+}
+
 } // namespace
 
 /*
@@ -145,8 +167,8 @@ private:
  */
 
 struct Connection::MessageHeader{
-	std::size_t contentLength = 0;
-	std::string contentType   = "application/vscode-jsonrpc; charset=utf-8";
+	std::size_t      contentLength = 0;
+	std::string_view contentType   = "application/vscode-jsonrpc; charset=utf-8";
 };
 
 Connection::Connection(io::Stream& stream)
@@ -164,29 +186,49 @@ Connection::Message Connection::readMessage()
 		if(reader.peek() == io::Stream::Eof)
 			throw ConnectionError{"Connection lost"};
 
-		const auto header = readMessageHeader(reader);
-
-		std::string content;
-		content.resize(header.contentLength);
-		reader.read(&content[0], header.contentLength);
+		const auto readStart = Clock::now();
+		const auto header    = readMessageHeader(reader);
 
-		readLock.unlock();
+		// The buffer goes back to the pool once the message has been parsed
+		auto content = m_contentBuffers.acquire(header.contentLength);
+		reader.read(content.data(), content.size());
+		const auto readEnd = Clock::now();
 
-		// Verify only after reading the entire message so no partially unread message is left in the stream
+		// Verify only after reading the entire message so no partially unread message is left in the stream.
+		// The content type refers to m_headerContentType which is only valid while the read lock is held.
 		verifyContentType(header.contentType);
 
-		auto json = json::parse(content);
+		readLock.unlock();
+
+		const auto parseStart = readEnd;
+		auto       json       = json::parse(content.view());
+		auto       parseTime  = Clock::now() - parseStart;
 #if LSP_MESSAGE_DEBUG_LOG
 		debugLogMessageJson("incoming", json);
 #endif
 
-		if(json.isObject())
-			return jsonrpc::messageFromJson(std::move(json.object()));
+		const auto convertStart = Clock::now();
+		auto       message      = Message();
 
-		if(!json.isArray())
+		if(json.isObject())
+			message = jsonrpc::messageFromJson(std::move(json.object()));
+		else if(json.isArray())
+			message = jsonrpc::messageBatchFromJson(std::move(json.array()));
+		else
 			throw jsonrpc::ProtocolError("Message must be a json object or array");
 
-		return jsonrpc::messageBatchFromJson(std::move(json.array()));
+		const auto parseEnd = Clock::now();
+		parseTime += parseEnd - convertStart;
+		recordReceivedMessage(message, content.size(), parseTime);
+
+		if(Tracer::isEnabled())
+		{
+			const auto [method, id] = traceTags(message);
+			Tracer::record("read", readStart, readEnd, method, id);
+			Tracer::record("parse", parseStart, parseEnd, method, id);
+		}
+
+		return message;
 	}
 	catch(const json::ParseError& e)
 	{
@@ -212,21 +254,64 @@ Connection::Message Connection::readMessage()
 	}
 }
 
-void Connection::writeMessage(Message&& message)
+void Connection::writeMessage(Message&& message, MessageMetrics::Method* responseMetrics)
 {
 	try
 	{
-		auto json = json::Value();
+		const auto convertStart = Clock::now();
+		auto       json         = json::Value();
+		auto*      metrics      = static_cast<MessageMetrics::Method*>(nullptr);
+		// The message is moved from before the spans are recorded
+		auto       traceMethod  = std::string();
+		auto       traceId      = std::optional<jsonrpc::MessageId>();
+
+		if(Tracer::isEnabled())
+		{
+			const auto [method, id] = traceTags(message);
+			traceMethod = method;
+
+			if(id)
+				traceId = *id;
+		}
 
 		if(auto* const msg = std::get_if<jsonrpc::Message>(&message))
+		{
+			if(const auto* request = std::get_if<jsonrpc::Request>(msg))
+				metrics = &m_metrics.method(request->method);
+			else
+				metrics = responseMetrics;
+
 			json = jsonrpc::messageToJson(std::move(*msg));
+		}
 		else
+		{
 			json = jsonrpc::messageBatchToJson(std::move(std::get<jsonrpc::MessageBatch>(message)));
+		}
 
+		auto serializationTime = Clock::now() - convertStart;
 #if LSP_MESSAGE_DEBUG_LOG
 		debugLogMessageJson("outgoing", json);
 #endif
-		writeMessageData(json::stringify(json));
+		const auto stringifyStart = Clock::now();
+		const auto content        = json::stringify(json);
+		const auto stringifyEnd   = Clock::now();
+		serializationTime += stringifyEnd - stringifyStart;
+
+		if(metrics)
+		{
+			metrics->sentCount.fetch_add(1, std::memory_order_relaxed);
+			metrics->sentBytes.record(content.size());
+			metrics->serializationTime.record(serializationTime);
+		}
+
+		writeMessageData(content);
+
+		if(Tracer::isEnabled())
+		{
+			const auto* id = traceId ? &*traceId : nullptr;
+			Tracer::record("stringify", convertStart, stringifyEnd, traceMethod, id);
+			Tracer::record("write", stringifyEnd, Clock::now(), traceMethod, id);
+		}
 	}
 	catch(const std::exception& e)
 	{
@@ -238,6 +323,31 @@ void Connection::writeMessage(Message&& message)
 	}
 }
 
+void Connection::recordReceivedMessage(const Message& message, std::size_t size, std::chrono::steady_clock::duration parseTime)
+{
+	// Responses are not recorded since they don't contain their method
+	const auto record = [this](const jsonrpc::Message& msg, std::size_t msgSize, Clock::duration msgParseTime)
+	{
+		if(const auto* request = std::get_if<jsonrpc::Request>(&msg))
+		{
+			auto& metrics = m_metrics.method(request->method);
+			metrics.receivedCount.fetch_add(1, std::memory_order_relaxed);
+			metrics.receivedBytes.record(msgSize);
+			metrics.parseTime.record(msgParseTime);
+		}
+	};
+
+	if(const auto* msg = std::get_if<jsonrpc::Message>(&message))
+	{
+		record(*msg, size, parseTime);
+	}
+	else if(const auto& batch = std::get<jsonrpc::MessageBatch>(message); !batch.empty())
+	{
+		for(const auto& member : batch)
+			record(member, size / batch.size(), parseTime / static_cast<Clock::rep>(batch.size()));
+	}
+}
+
 Connection::MessageHeader Connection::readMessageHeader(InputReader& reader)
 {
 	MessageHeader header;
@@ -271,7 +381,8 @@ void Connection::parseHeaderValue(MessageHeader& header, std::string_view line)
 		}
 		else if(equalCaseInsensitive(key, "Content-Type"))
 		{
-			header.contentType = std::string{value.data(), value.size()};
+			m_headerContentType.assign(value);
+			header.contentType = m_headerContentType;
 		}
 	}
 }
@@ -281,7 +392,7 @@ void Connection::readNextMessageHeaderField(MessageHeader& header, InputReader&
 	if(reader.peek() == std::char_traits<char>::eof())
 		throw ConnectionError{"Connection lost"};
 
-	std::string lineData;
+	m_headerLine.clear();
 
 	while(reader.peek() != '\r')
 	{
@@ -290,10 +401,10 @@ void Connection::readNextMessageHeaderField(MessageHeader& header, InputReader&
 		if(c == '\n')
 			throw ConnectionError("Protocol: Unexpected '\\n' in header field, expected '\\r\\n'");
 
-		lineData.push_back(c);
+		m_headerLine.push_back(c);
 	}
 
-	parseHeaderValue(header, lineData);
+	parseHeaderValue(header, m_headerLine);
 
 	if(reader.get() != '\r' || reader.get() != '\n')
 		throw ConnectionError("Protocol: Expected header field to be terminated by '\\r\\n'");
@@ -310,7 +421,7 @@ void Connection::writeMessageData(const std::string& content)
 std::string Connection::messageHeaderString(const MessageHeader& header)
 {
 	return "Content-Length: " + std::to_string(header.contentLength) + "\r\n" +
-	       "Content-Type: " + header.contentType + "\r\n\r\n";
+	       "Content-Type: " + std::string(header.contentType) + "\r\n\r\n";
 }
 
 } // namespace lsp
@@ -3,8 +3,10 @@
 #include <mutex>
 #include <string>
 #include <variant>
+#include <lsp/bufferpool.h>
 #include <lsp/exception.h>
 #include <lsp/jsonrpc/jsonrpc.h>
+#include <lsp/metrics.h>
 
 namespace lsp{
 namespace json{
@@ -26,20 +28,31 @@ public:
 	Connection(io::Stream& stream);
 
 	Message readMessage();
-	void writeMessage(Message&& message);
+	// Responses don't contain their method so their size and serialization time are only recorded if responseMetrics is set
+	void writeMessage(Message&& message, MessageMetrics::Method* responseMetrics = nullptr);
+
+	// Statistics of the requests and notifications that were read and written and of the responses to them.
+	// The members of a batch that was read share its size and parse time evenly.
+	[[nodiscard]] MessageMetrics& metrics(){ return m_metrics; }
 
 private:
-	io::Stream& m_stream;
-	std::mutex  m_readMutex;
-	std::mutex  m_writeMutex;
+	io::Stream&    m_stream;
+	std::mutex     m_readMutex;
+	std::mutex     m_writeMutex;
+	BufferPool     m_contentBuffers;
+	MessageMetrics m_metrics;
+	// Reused for every message while holding m_readMutex
+	std::string    m_headerLine;
+	std::string    m_headerContentType;
 
 	struct MessageHeader;
 	class InputReader;
 
 	MessageHeader readMessageHeader(InputReader& reader);
-	static void parseHeaderValue(MessageHeader& header, std::string_view line);
-	static void readNextMessageHeaderField(MessageHeader& header, InputReader& reader);
+	void parseHeaderValue(MessageHeader& header, std::string_view line);
+	void readNextMessageHeaderField(MessageHeader& header, InputReader& reader);
 	void writeMessageData(const std::string& content);
+	void recordReceivedMessage(const Message& message, std::size_t size, std::chrono::steady_clock::duration parseTime);
 	std::string messageHeaderString(const MessageHeader& header);
 };
 
@@ -26,7 +26,9 @@ public:
 		RequestFailed        = -32803,
 		ServerCancelled      = -32802,
 		ContentModified      = -32801,
-		RequestCancelled     = -32800
+		RequestCancelled     = -32800,
+		// Not sent by the other side. Used for outgoing requests that didn't receive a response in time.
+		RequestTimedOut      = -32000
 	};
 
 protected:
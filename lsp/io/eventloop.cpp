@@ -0,0 +1,717 @@
+#include <lsp/io/eventloop.h>
+
+#ifndef LSP_EVENTLOOP_UNSUPPORTED
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <lsp/connection.h>
+#include <lsp/messagehandler.h>
+#include <lsp/threadpool.h>
+#include <lsp/io/messageframe.h>
+
+namespace lsp::io{
+namespace{
+
+using EventId = std::uint64_t;
+
+constexpr EventId     WakeEventId         = 0;
+constexpr int         MaxEventsPerWait    = 64;
+constexpr std::size_t ReceiveChunkSize    = 64 * 1024;
+constexpr std::size_t InputCompactionSize = 64 * 1024;
+constexpr auto        AcceptRetryDelay    = std::chrono::milliseconds(100);
+constexpr auto        SessionReleaseDelay = std::chrono::milliseconds(10);
+
+[[noreturn]] void throwSystemError(const std::string& msg)
+{
+	throw Error(msg + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+struct EventLoop::Impl{
+	/*
+	 * Session
+	 * A single connection. The session is the stream its Connection reads from and writes to.
+	 * The event loop thread appends received data and counts complete message frames.
+	 * Reading only ever happens once a complete frame is available so processing never blocks.
+	 * Once the peer has finished sending, the session stays open until its responses were sent.
+	 */
+	class Session final : public Stream{
+	public:
+		Session(Impl& loop, EventId id, Socket&& socket)
+			: m_loop{loop}
+			, m_id{id}
+			, m_socket{std::move(socket)}
+			, m_connection{*this}
+			, m_messageHandler{m_connection, loop.m_threadPool}
+		{
+		}
+
+		EventId id() const{ return m_id; }
+		int fd() const{ return m_socket.nativeHandle(); }
+		MessageHandler& messageHandler(){ return m_messageHandler; }
+
+		void read(char* buffer, std::size_t size) override
+		{
+			const auto lock = std::lock_guard(m_inputMutex);
+
+			if(m_scanPos - m_readPos < size)
+				throw Error("Attempting to read past the end of the current message");
+
+			std::memcpy(buffer, m_input.data() + m_readPos, size);
+			m_readPos += size;
+		}
+
+		void write(const char* buffer, std::size_t size) override
+		{
+			const auto lock = std::lock_guard(m_outputMutex);
+
+			if(m_output.empty())
+			{
+				const auto bytesSent = sendSome(buffer, size);
+				buffer += bytesSent;
+				size -= bytesSent;
+
+				if(size == 0)
+					return;
+
+				m_output.append(buffer, size);
+				updateEvents();
+				return;
+			}
+
+			m_output.append(buffer, size);
+		}
+
+		// Called from the event loop thread. Returns false if the connection failed.
+		// The end of the input only marks it as finished since the peer might still be waiting for responses.
+		bool receive()
+		{
+			char chunk[ReceiveChunkSize];
+
+			while(true)
+			{
+				const auto bytesRead = recv(fd(), chunk, sizeof(chunk), 0);
+
+				if(bytesRead < 0)
+				{
+					if(errno == EINTR)
+						continue;
+
+					return errno == EAGAIN || errno == EWOULDBLOCK;
+				}
+
+				if(bytesRead == 0)
+					return finishInput();
+
+				appendInput(chunk, static_cast<std::size_t>(bytesRead));
+			}
+		}
+
+		// Called from the event loop thread when the socket becomes writable
+		bool flush()
+		{
+			const auto lock = std::lock_guard(m_outputMutex);
+
+			try
+			{
+				const auto bytesSent = sendSome(m_output.data(), m_output.size());
+				m_output.erase(0, bytesSent);
+
+				if(m_output.empty())
+					updateEvents();
+			}
+			catch(const Error&)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		[[nodiscard]] bool isInputFinished()
+		{
+			const auto lock = std::lock_guard(m_outputMutex);
+			return m_inputFinished;
+		}
+
+		// True if everything that was received has been processed and answered
+		[[nodiscard]] bool isIdle()
+		{
+			{
+				const auto lock = std::lock_guard(m_inputMutex);
+
+				if(m_processing)
+					return false;
+			}
+
+			{
+				const auto lock = std::lock_guard(m_outputMutex);
+
+				if(!m_output.empty())
+					return false;
+			}
+
+			return !m_messageHandler.hasPendingTasks();
+		}
+
+		// Called from a worker thread. Returns true if a complete message is available and marks it as consumed.
+		bool beginMessage()
+		{
+			const auto lock = std::lock_guard(m_inputMutex);
+
+			if(m_completeFrames == 0)
+			{
+				m_processing = false;
+				return false;
+			}
+
+			--m_completeFrames;
+			return true;
+		}
+
+	private:
+		Impl&          m_loop;
+		const EventId  m_id;
+		Socket         m_socket;
+		std::mutex     m_inputMutex;
+		std::string    m_input;
+		std::size_t    m_readPos        = 0;
+		std::size_t    m_scanPos        = 0;
+		std::size_t    m_completeFrames = 0;
+		bool           m_processing     = false;
+		std::mutex     m_outputMutex;
+		std::string    m_output;
+		bool           m_inputFinished  = false; // Guarded by m_outputMutex since it determines the watched events
+		Connection     m_connection;
+		MessageHandler m_messageHandler;
+
+		// Requires m_outputMutex to be locked
+		void updateEvents()
+		{
+			auto events = m_output.empty() ? 0u : EPOLLOUT;
+
+			if(!m_inputFinished)
+				events |= EPOLLIN | EPOLLRDHUP;
+
+			m_loop.modifyEvents(*this, events);
+		}
+
+		bool finishInput()
+		{
+			const auto lock = std::lock_guard(m_outputMutex);
+			m_inputFinished = true;
+
+			try
+			{
+				updateEvents();
+			}
+			catch(const Error&)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		std::size_t sendSome(const char* buffer, std::size_t size)
+		{
+			std::size_t totalBytesSent = 0;
+
+			while(totalBytesSent < size)
+			{
+				const auto bytesSent = send(fd(), buffer + totalBytesSent, size - totalBytesSent, MSG_NOSIGNAL);
+
+				if(bytesSent < 0)
+				{
+					if(errno == EINTR)
+						continue;
+
+					if(errno == EAGAIN || errno == EWOULDBLOCK)
+						break;
+
+					throwSystemError("Failed to write to socket");
+				}
+
+				totalBytesSent += static_cast<std::size_t>(bytesSent);
+			}
+
+			return totalBytesSent;
+		}
+
+		void appendInput(const char* data, std::size_t size)
+		{
+			bool schedule = false;
+
+			{
+				const auto lock = std::lock_guard(m_inputMutex);
+
+				if(m_readPos == m_input.size())
+				{
+					m_input.clear();
+					m_scanPos = m_readPos = 0;
+				}
+				else if(m_readPos >= InputCompactionSize)
+				{
+					m_input.erase(0, m_readPos);
+					m_scanPos -= m_readPos;
+					m_readPos = 0;
+				}
+
+				m_input.append(data, size);
+
+				while(const auto frame = findMessageFrame(std::string_view(m_input).substr(m_scanPos)))
+				{
+					m_scanPos += frame->size();
+					++m_completeFrames;
+				}
+
+				if(m_completeFrames > 0 && !m_processing)
+				{
+					m_processing = true;
+					schedule = true;
+				}
+			}
+
+			if(schedule)
+				m_loop.scheduleProcessing(*this);
+		}
+	};
+
+	using SessionPtr = std::shared_ptr<Session>;
+
+	struct Listener{
+		SocketListener&     listener;
+		SessionInitializer  initializer;
+		ThreadPool::TimerId retryTimer = TimerWheel::InvalidTimerId; // Re-enables accepting after running out of descriptors
+	};
+
+	int                                       m_epollFd = -1;
+	int                                       m_wakeFd  = -1;
+	std::atomic<bool>                         m_stopped = false;
+	std::atomic<EventId>                      m_nextId  = WakeEventId + 1;
+	mutable std::mutex                        m_mutex;
+	std::unordered_map<EventId, Listener>     m_listeners;
+	std::unordered_map<EventId, SessionPtr>   m_sessions;
+	// Sessions whose peer has finished sending. They are closed once they are idle.
+	std::vector<EventId>                      m_finishingSessions;
+	// Closed sessions that are destroyed on a worker thread once nothing uses them anymore
+	std::vector<SessionPtr>                   m_closedSessions;
+	ThreadPool::TimerId                       m_releaseTimer = TimerWheel::InvalidTimerId;
+	ThreadPool                                m_threadPool;
+
+	explicit Impl(const ThreadPoolOptions& workerOptions)
+		: m_threadPool(workerOptions)
+	{
+		m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+		if(m_epollFd == -1)
+			throwSystemError("Failed to create epoll instance");
+
+		m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if(m_wakeFd == -1)
+		{
+			close(m_epollFd);
+			throwSystemError("Failed to create eventfd");
+		}
+
+		auto event = epoll_event{};
+		event.events   = EPOLLIN;
+		event.data.u64 = WakeEventId;
+		epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event);
+	}
+
+	~Impl()
+	{
+		{
+			const auto lock = std::lock_guard(m_mutex);
+
+			for(auto& [id, listener] : m_listeners)
+			{
+				if(listener.retryTimer != TimerWheel::InvalidTimerId)
+					m_threadPool.cancelTimer(listener.retryTimer);
+			}
+
+			if(m_releaseTimer != TimerWheel::InvalidTimerId)
+				m_threadPool.cancelTimer(m_releaseTimer);
+		}
+
+		m_threadPool.waitUntilFinished();
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+			m_sessions.clear();
+			m_closedSessions.clear();
+		}
+
+		close(m_wakeFd);
+		close(m_epollFd);
+	}
+
+	void addListener(SocketListener& listener, SessionInitializer&& initializer)
+	{
+		listener.setNonBlocking(true);
+
+		const auto lock = std::lock_guard(m_mutex);
+		const auto id   = m_nextId++;
+		m_listeners.emplace(id, Listener{listener, std::move(initializer)});
+		addToEpoll(listener.nativeHandle(), id, EPOLLIN);
+	}
+
+	void addSocket(Socket&& socket, const SessionInitializer& initializer)
+	{
+		socket.setNonBlocking(true);
+
+		const auto id      = m_nextId++;
+		const auto session = std::make_shared<Session>(*this, id, std::move(socket));
+
+		if(initializer)
+			initializer(session->messageHandler());
+
+		const auto lock = std::lock_guard(m_mutex);
+		m_sessions.emplace(id, session);
+		addToEpoll(session->fd(), id, EPOLLIN | EPOLLRDHUP);
+	}
+
+	void addToEpoll(int fd, EventId id, std::uint32_t events)
+	{
+		auto event = epoll_event{};
+		event.events   = events;
+		event.data.u64 = id;
+
+		if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+			throwSystemError("Failed to add file descriptor to epoll");
+	}
+
+	// Fails once the session was closed, in which case pending output can't be sent anymore
+	void modifyEvents(const Session& session, std::uint32_t events)
+	{
+		auto event = epoll_event{};
+		event.events   = events;
+		event.data.u64 = session.id();
+
+		if(epoll_ctl(m_epollFd, EPOLL_CTL_MOD, session.fd(), &event) == -1)
+			throwSystemError("Failed to modify watched socket events");
+	}
+
+	void run()
+	{
+		epoll_event events[MaxEventsPerWait];
+
+		while(!m_stopped)
+		{
+			const auto eventCount = epoll_wait(m_epollFd, events, MaxEventsPerWait, -1);
+
+			if(eventCount < 0)
+			{
+				if(errno == EINTR)
+					continue;
+
+				throwSystemError("epoll_wait failed");
+			}
+
+			for(int i = 0; i < eventCount; ++i)
+			{
+				const auto& event = events[i];
+
+				if(event.data.u64 == WakeEventId)
+				{
+					std::uint64_t value;
+					[[maybe_unused]] const auto bytesRead = ::read(m_wakeFd, &value, sizeof(value));
+					continue;
+				}
+
+				handleEvent(event.data.u64, event.events);
+			}
+		}
+
+		// Allow running the loop again
+		m_stopped = false;
+	}
+
+	void stop()
+	{
+		m_stopped = true;
+		const std::uint64_t value = 1;
+		[[maybe_unused]] const auto bytesWritten = ::write(m_wakeFd, &value, sizeof(value));
+	}
+
+	void handleEvent(EventId id, std::uint32_t events)
+	{
+		SessionPtr session;
+		Listener*  listener = nullptr;
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+
+			if(const auto it = m_listeners.find(id); it != m_listeners.end())
+				listener = &it->second; // Listeners are never removed
+			else if(const auto it = m_sessions.find(id); it != m_sessions.end())
+				session = it->second;
+		}
+
+		if(listener)
+		{
+			acceptConnections(id, *listener);
+			return;
+		}
+
+		if(!session)
+			return;
+
+		const auto wasInputFinished = session->isInputFinished();
+		bool       open             = (events & EPOLLERR) == 0;
+
+		// Data that arrived before the peer hung up is still read and processed
+		if(open && !wasInputFinished && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+			open = session->receive();
+
+		if(open && (events & EPOLLOUT))
+			open = session->flush();
+
+		// Nothing can be sent anymore once the connection is closed in both directions
+		if(!open || (events & EPOLLHUP))
+			closeSession(*session);
+		else if(!wasInputFinished && session->isInputFinished())
+			finishSession(*session);
+	}
+
+	void acceptConnections(EventId id, Listener& listener)
+	{
+		while(true)
+		{
+			auto socket = std::optional<Socket>();
+
+			try
+			{
+				socket.emplace(listener.listener.listen());
+			}
+			catch(const Error&)
+			{
+				// The listener stays readable while the pending connection can't be accepted, e.g. after running out of descriptors.
+				// Stop waiting for it until some had a chance to be released instead of spinning.
+				pauseAccepting(id, listener);
+				break;
+			}
+
+			if(!socket->isOpen())
+				break;
+
+			try
+			{
+				addSocket(std::move(*socket), listener.initializer);
+			}
+			catch(const std::exception&)
+			{
+				// Only this connection is lost
+			}
+		}
+	}
+
+	void pauseAccepting(EventId id, Listener& listener)
+	{
+		const auto fd = listener.listener.nativeHandle();
+		auto event = epoll_event{};
+		event.data.u64 = id;
+		epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event);
+
+		const auto lock = std::lock_guard(m_mutex);
+		listener.retryTimer = m_threadPool.addDelayedTask(AcceptRetryDelay, [this, id, fd, &listener]()
+		{
+			const auto lock = std::lock_guard(m_mutex);
+			listener.retryTimer = TimerWheel::InvalidTimerId;
+
+			auto event = epoll_event{};
+			event.events   = EPOLLIN;
+			event.data.u64 = id;
+			epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event);
+		});
+	}
+
+	void scheduleProcessing(Session& session)
+	{
+		SessionPtr sessionPtr;
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+
+			if(const auto it = m_sessions.find(session.id()); it != m_sessions.end())
+				sessionPtr = it->second;
+		}
+
+		if(!sessionPtr)
+			return;
+
+		m_threadPool.post([this, session = std::move(sessionPtr)]()
+		{
+			try
+			{
+				while(session->beginMessage())
+					session->messageHandler().processIncomingMessages();
+			}
+			catch(const std::exception&)
+			{
+				closeSession(*session);
+			}
+		});
+	}
+
+	// The peer won't send anything else but is still waiting for the responses to what it has sent
+	void finishSession(Session& session)
+	{
+		if(session.isIdle())
+		{
+			closeSession(session);
+			return;
+		}
+
+		const auto lock = std::lock_guard(m_mutex);
+		m_finishingSessions.push_back(session.id());
+		scheduleRelease();
+	}
+
+	// Requires m_mutex to be locked
+	void scheduleRelease()
+	{
+		if(m_releaseTimer == TimerWheel::InvalidTimerId)
+			m_releaseTimer = m_threadPool.addDelayedTask(SessionReleaseDelay, [this](){ releaseClosedSessions(); });
+	}
+
+	// Destroying a session waits for the work its message handler posted to the pool,
+	// so it is only released by releaseClosedSessions once there is none left.
+	void closeSession(Session& session)
+	{
+		const auto lock = std::lock_guard(m_mutex);
+
+		if(const auto it = m_sessions.find(session.id()); it != m_sessions.end())
+		{
+			// Remove the descriptor while the socket is still open so it can't be confused with a reused one
+			epoll_ctl(m_epollFd, EPOLL_CTL_DEL, session.fd(), nullptr);
+			m_closedSessions.push_back(std::move(it->second));
+			m_sessions.erase(it);
+			scheduleRelease();
+		}
+	}
+
+	// Runs on a worker thread. Sessions with request timeouts that have not expired yet are kept until they do.
+	void releaseClosedSessions()
+	{
+		std::vector<SessionPtr> finished;
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+			m_releaseTimer = TimerWheel::InvalidTimerId;
+
+			// Sessions that were closed in the meantime are dropped from the list as well
+			std::erase_if(m_finishingSessions, [this, &finished](EventId id){
+				const auto it = m_sessions.find(id);
+
+				if(it == m_sessions.end())
+					return true;
+
+				if(!it->second->isIdle())
+					return false;
+
+				finished.push_back(it->second);
+				return true;
+			});
+		}
+
+		for(const auto& session : finished)
+			closeSession(*session);
+
+		finished.clear();
+
+		std::vector<SessionPtr> released;
+
+		{
+			const auto lock = std::lock_guard(m_mutex);
+
+			// Copies of a session are only made while it is in m_sessions so none can be added anymore
+			const auto unused = std::partition(m_closedSessions.begin(), m_closedSessions.end(), [](const SessionPtr& session){
+				return session.use_count() > 1 || session->messageHandler().hasPendingTasks();
+			});
+
+			released.assign(std::make_move_iterator(unused), std::make_move_iterator(m_closedSessions.end()));
+			m_closedSessions.erase(unused, m_closedSessions.end());
+
+			if(!m_closedSessions.empty() || !m_finishingSessions.empty())
+				scheduleRelease();
+		}
+	}
+};
+
+/*
+ * EventLoop
+ */
+
+EventLoop::EventLoop(unsigned int workerThreads)
+	: EventLoop(ThreadPoolOptions{.minThreads = 0, .maxThreads = workerThreads})
+{
+}
+
+EventLoop::EventLoop(const ThreadPoolOptions& workerOptions)
+	: m_impl{std::make_unique<Impl>(workerOptions)}
+{
+}
+
+EventLoop::~EventLoop()
+{
+	stop();
+}
+
+void EventLoop::addListener(SocketListener& listener, SessionInitializer initializer)
+{
+	if(!listener.isReady())
+		throw Error("Server socket is not open for listening");
+
+	m_impl->addListener(listener, std::move(initializer));
+}
+
+void EventLoop::addSocket(Socket&& socket, SessionInitializer initializer)
+{
+	if(!socket.isOpen())
+		throw Error("Socket is not open");
+
+	m_impl->addSocket(std::move(socket), initializer);
+}
+
+void EventLoop::run()
+{
+	m_impl->run();
+}
+
+void EventLoop::stop()
+{
+	m_impl->stop();
+}
+
+std::size_t EventLoop::sessionCount() const
+{
+	const auto lock = std::lock_guard(m_impl->m_mutex);
+	return m_impl->m_sessions.size();
+}
+
+ThreadPool::Stats EventLoop::workerStats() const
+{
+	return m_impl->m_threadPool.stats();
+}
+
+} // namespace lsp::io
+
+#endif // LSP_EVENTLOOP_UNSUPPORTED
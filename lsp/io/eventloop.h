@@ -0,0 +1,67 @@
+#pragma once
+
+#include <lsp/io/socket.h>
+
+#if defined(__linux__) && !defined(LSP_SOCKET_UNSUPPORTED)
+	#define LSP_EVENTLOOP_EPOLL
+#else
+	#define LSP_EVENTLOOP_UNSUPPORTED
+#endif
+
+#ifndef LSP_EVENTLOOP_UNSUPPORTED
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <lsp/threadpool.h>
+
+namespace lsp{
+class MessageHandler;
+} // namespace lsp
+
+namespace lsp::io{
+
+/*
+ * EventLoop
+ *
+ * Multiplexes many socket connections on a single thread using epoll.
+ * Incoming data is framed incrementally and every complete message is dispatched to
+ * the MessageHandler of its connection on a worker pool that is shared by all connections.
+ * The message handlers use the same pool for asynchronous work and request timeouts.
+ * Messages of the same connection are processed one after another in the order they were received.
+ * If the peer shuts down its sending side the connection stays open until every response was sent.
+ * Closed connections are destroyed on a worker thread once the work of their message handler has finished.
+ */
+class EventLoop{
+public:
+	// Called once for every new connection to register the message callbacks
+	using SessionInitializer = std::function<void(MessageHandler& messageHandler)>;
+
+	explicit EventLoop(unsigned int workerThreads = std::thread::hardware_concurrency());
+	explicit EventLoop(const ThreadPoolOptions& workerOptions);
+	~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	// The listener must stay alive until the event loop is destroyed.
+	void addListener(SocketListener& listener, SessionInitializer initializer);
+	void addSocket(Socket&& socket, SessionInitializer initializer);
+
+	// Blocks until stop is called. Can only be called from one thread at a time.
+	void run();
+	// Can be called from any thread including message callbacks.
+	void stop();
+
+	[[nodiscard]] std::size_t sessionCount() const;
+	[[nodiscard]] ThreadPool::Stats workerStats() const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace lsp::io
+
+#endif // LSP_EVENTLOOP_UNSUPPORTED
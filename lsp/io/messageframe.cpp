@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <lsp/io/messageframe.h>
+
+namespace lsp::io{
+namespace{
+
+std::string_view trimWhitespace(std::string_view str)
+{
+	while(!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+		str.remove_prefix(1);
+
+	while(!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+		str.remove_suffix(1);
+
+	return str;
+}
+
+bool equalCaseInsensitive(std::string_view lhs, std::string_view rhs)
+{
+	return std::ranges::equal(lhs, rhs, [](char a, char b)
+		{
+			return std::tolower(static_cast<unsigned char>(a)) ==
+			       std::tolower(static_cast<unsigned char>(b));
+		});
+}
+
+std::size_t parseContentLength(std::string_view header)
+{
+	while(!header.empty())
+	{
+		const auto lineEnd = header.find("\r\n");
+		const auto line    = header.substr(0, lineEnd);
+		const auto sepIdx  = line.find(':');
+
+		if(sepIdx != std::string_view::npos && equalCaseInsensitive(trimWhitespace(line.substr(0, sepIdx)), "Content-Length"))
+		{
+			const auto value       = trimWhitespace(line.substr(sepIdx + 1));
+			std::size_t contentLen = 0;
+			const auto [ptr, ec]   = std::from_chars(value.data(), value.data() + value.size(), contentLen);
+
+			if(ec == std::errc{} && ptr == value.data() + value.size())
+				return contentLen;
+
+			return 0;
+		}
+
+		if(lineEnd == std::string_view::npos)
+			break;
+
+		header.remove_prefix(lineEnd + 2);
+	}
+
+	return 0;
+}
+
+} // namespace
+
+std::optional<MessageFrame> findMessageFrame(std::string_view data)
+{
+	constexpr auto HeaderEnd = std::string_view("\r\n\r\n");
+
+	// Header without any fields
+	if(data.starts_with("\r\n"))
+		return MessageFrame{.headerSize = 2};
+
+	const auto headerEndIdx = data.find(HeaderEnd);
+
+	if(headerEndIdx == std::string_view::npos)
+		return std::nullopt;
+
+	auto frame = MessageFrame{
+		.headerSize    = headerEndIdx + HeaderEnd.size(),
+		.contentLength = parseContentLength(data.substr(0, headerEndIdx))
+	};
+
+	if(data.size() < frame.size())
+		return std::nullopt;
+
+	return frame;
+}
+
+} // namespace lsp::io
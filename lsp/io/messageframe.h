@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace lsp::io{
+
+/*
+ * Location of a complete base protocol message ('<header>\r\n\r\n<content>') inside of a byte buffer.
+ * Used to frame messages incrementally when data arrives in arbitrary chunks.
+ */
+struct MessageFrame{
+	std::size_t headerSize    = 0; // Including the terminating '\r\n\r\n'
+	std::size_t contentLength = 0;
+
+	[[nodiscard]] std::size_t size() const{ return headerSize + contentLength; }
+};
+
+/*
+ * Returns the first message frame at the start of data or std::nullopt if data does not contain a complete message yet.
+ * A header without a valid Content-Length field results in a frame with empty content so that the
+ * malformed header is consumed and reported by lsp::Connection.
+ */
+[[nodiscard]] std::optional<MessageFrame> findMessageFrame(std::string_view data);
+
+} // namespace lsp::io
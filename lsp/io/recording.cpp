@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <lsp/io/messageframe.h>
+#include <lsp/io/recording.h>
+
+#if defined(__APPLE__) || defined(__linux__) || defined(__HAIKU__)
+	#define LSP_RECORDING_POSIX
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#elif defined(_WIN32)
+	#define LSP_RECORDING_WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+#else
+	#include <iterator>
+#endif
+
+namespace lsp::io{
+namespace{
+
+constexpr std::size_t alignedSize(std::size_t size)
+{
+	return (size + RecordingAlignment - 1) & ~(RecordingAlignment - 1);
+}
+
+std::int64_t nanosecondsSinceEpoch(std::chrono::system_clock::time_point time)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+} // namespace
+
+/*
+ * RecordingStream::Impl
+ */
+
+struct RecordingStream::Impl{
+	// Collects the data of one direction until it forms a complete message
+	struct Capture{
+		std::mutex  mutex;
+		std::string data;
+	};
+
+	Stream&                               stream;
+	std::ofstream                         file;
+	std::mutex                            fileMutex;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	Capture                               incoming;
+	Capture                               outgoing;
+
+	Impl(Stream& stream, const std::string& recordingFilePath)
+		: stream{stream}
+		, file{recordingFilePath, std::ios::binary | std::ios::trunc}
+	{
+		if(!file)
+			throw Error("Failed to create recording file '" + recordingFilePath + '\'');
+
+		auto header      = RecordingFileHeader();
+		header.startTime = nanosecondsSinceEpoch(std::chrono::system_clock::now());
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.flush();
+	}
+
+	void capture(Capture& capture, MessageDirection direction, const char* buffer, std::size_t size)
+	{
+		const auto lock = std::lock_guard(capture.mutex);
+		capture.data.append(buffer, size);
+
+		std::size_t consumed = 0;
+
+		while(const auto frame = findMessageFrame(std::string_view(capture.data).substr(consumed)))
+		{
+			record(direction, std::string_view(capture.data).substr(consumed, frame->size()));
+			consumed += frame->size();
+		}
+
+		capture.data.erase(0, consumed);
+	}
+
+	void record(MessageDirection direction, std::string_view message)
+	{
+		static constexpr char Padding[RecordingAlignment] = {};
+
+		auto header      = RecordedMessageHeader();
+		header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+		header.size      = static_cast<std::uint32_t>(message.size());
+		header.direction = direction;
+
+		const auto lock = std::lock_guard(fileMutex);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(message.data(), static_cast<std::streamsize>(message.size()));
+		file.write(Padding, static_cast<std::streamsize>(alignedSize(message.size()) - message.size()));
+		// Recordings are mostly needed when the process crashes, which would lose buffered messages
+		file.flush();
+	}
+};
+
+/*
+ * RecordingStream
+ */
+
+RecordingStream::RecordingStream(Stream& stream, const std::string& recordingFilePath)
+	: m_impl{std::make_unique<Impl>(stream, recordingFilePath)}
+{
+}
+
+RecordingStream::~RecordingStream() = default;
+
+void RecordingStream::read(char* buffer, std::size_t size)
+{
+	m_impl->stream.read(buffer, size);
+	m_impl->capture(m_impl->incoming, MessageDirection::Incoming, buffer, size);
+}
+
+void RecordingStream::write(const char* buffer, std::size_t size)
+{
+	m_impl->stream.write(buffer, size);
+	m_impl->capture(m_impl->outgoing, MessageDirection::Outgoing, buffer, size);
+}
+
+/*
+ * FileMapping
+ * Owns the mapped file contents. Kept separate from Recording::Impl so it is released
+ * if the Recording::Impl constructor throws after the file was mapped.
+ */
+
+namespace{
+
+class FileMapping{
+public:
+	FileMapping() = default;
+	FileMapping(const FileMapping&) = delete;
+	FileMapping& operator=(const FileMapping&) = delete;
+
+	~FileMapping()
+	{
+#ifdef LSP_RECORDING_POSIX
+		if(m_mapping != MAP_FAILED)
+			munmap(m_mapping, m_data.size());
+#elif defined(LSP_RECORDING_WIN32)
+		if(m_view)
+			UnmapViewOfFile(m_view);
+
+		if(m_mapping)
+			CloseHandle(m_mapping);
+
+		if(m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+#endif
+	}
+
+	[[nodiscard]] std::string_view data() const{ return m_data; }
+
+	void map(const std::string& path)
+	{
+#ifdef LSP_RECORDING_POSIX
+		const auto fd = open(path.c_str(), O_RDONLY);
+
+		if(fd == -1)
+			throw Error("Failed to open recording '" + path + "': " + std::strerror(errno));
+
+		struct stat fileStat;
+		const auto sizeValid = fstat(fd, &fileStat) == 0 && static_cast<std::size_t>(fileStat.st_size) >= sizeof(RecordingFileHeader);
+		const auto size      = sizeValid ? static_cast<std::size_t>(fileStat.st_size) : 0;
+
+		if(sizeValid)
+			m_mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+
+		if(!sizeValid)
+			throw Error("Invalid recording '" + path + '\'');
+
+		if(m_mapping == MAP_FAILED)
+			throw Error("Failed to map recording '" + path + "': " + std::strerror(errno));
+
+		m_data = {static_cast<const char*>(m_mapping), size};
+#elif defined(LSP_RECORDING_WIN32)
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if(m_file == INVALID_HANDLE_VALUE)
+			throw Error("Failed to open recording '" + path + '\'');
+
+		LARGE_INTEGER fileSize;
+		if(!GetFileSizeEx(m_file, &fileSize) || static_cast<std::size_t>(fileSize.QuadPart) < sizeof(RecordingFileHeader))
+			throw Error("Invalid recording '" + path + '\'');
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		m_view    = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+		if(!m_view)
+			throw Error("Failed to map recording '" + path + '\'');
+
+		m_data = {static_cast<const char*>(m_view), static_cast<std::size_t>(fileSize.QuadPart)};
+#else
+		auto file = std::ifstream(path, std::ios::binary);
+
+		if(!file)
+			throw Error("Failed to open recording '" + path + '\'');
+
+		m_contents = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		m_data     = m_contents;
+#endif
+	}
+
+private:
+	std::string_view m_data;
+#ifdef LSP_RECORDING_POSIX
+	void*            m_mapping = MAP_FAILED;
+#elif defined(LSP_RECORDING_WIN32)
+	HANDLE           m_file    = INVALID_HANDLE_VALUE;
+	HANDLE           m_mapping = nullptr;
+	void*            m_view    = nullptr;
+#else
+	std::string      m_contents;
+#endif
+};
+
+} // namespace
+
+/*
+ * Recording::Impl
+ */
+
+struct Recording::Impl{
+	FileMapping          mapping;
+	std::int64_t         startTime = 0;
+	std::vector<Message> messages;
+
+	Impl(const std::string& path)
+	{
+		mapping.map(path);
+		parse(path);
+	}
+
+	void parse(const std::string& path)
+	{
+		const auto data = mapping.data();
+		auto fileHeader = RecordingFileHeader();
+
+		if(data.size() < sizeof(fileHeader))
+			throw Error("Invalid recording '" + path + '\'');
+
+		std::memcpy(&fileHeader, data.data(), sizeof(fileHeader));
+
+		if(fileHeader.magic != RecordingMagic)
+			throw Error("Invalid recording '" + path + '\'');
+
+		if(fileHeader.version != RecordingVersion)
+			throw Error("Unsupported recording version " + std::to_string(fileHeader.version) + " in '" + path + '\'');
+
+		startTime = fileHeader.startTime;
+
+		auto offset = sizeof(fileHeader);
+
+		while(data.size() - offset >= sizeof(RecordedMessageHeader))
+		{
+			auto header = RecordedMessageHeader();
+			std::memcpy(&header, data.data() + offset, sizeof(header));
+			offset += sizeof(header);
+
+			// A truncated last message is ignored since the recording might not have been closed properly
+			if(data.size() - offset < header.size)
+				break;
+
+			messages.push_back({
+				.timestamp = std::chrono::nanoseconds(header.timestamp),
+				.direction = header.direction,
+				.data      = data.substr(offset, header.size)
+			});
+
+			offset += std::min(alignedSize(header.size), data.size() - offset);
+		}
+	}
+};
+
+/*
+ * Recording
+ */
+
+Recording::Recording(const std::string& path)
+	: m_impl{std::make_unique<Impl>(path)}
+{
+}
+
+Recording::Recording(Recording&&) noexcept = default;
+Recording& Recording::operator=(Recording&&) noexcept = default;
+Recording::~Recording() = default;
+
+std::chrono::system_clock::time_point Recording::startTime() const
+{
+	return std::chrono::system_clock::time_point(
+		std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(m_impl->startTime)));
+}
+
+const std::vector<Recording::Message>& Recording::messages() const
+{
+	return m_impl->messages;
+}
+
+} // namespace lsp::io
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <lsp/io/stream.h>
+
+namespace lsp::io{
+
+/*
+ * Recording file format
+ *
+ * A recording starts with a RecordingFileHeader which is followed by one entry per framed message.
+ * Each entry is a RecordedMessageHeader followed by the raw message ('<header>\r\n\r\n<content>') and padding up to
+ * the next multiple of RecordingAlignment bytes. All values are stored in the native byte order so a recording can
+ * be memory mapped and used in place.
+ */
+
+enum class MessageDirection : std::uint32_t{
+	Incoming, // Read from the recorded stream
+	Outgoing  // Written to the recorded stream
+};
+
+inline constexpr std::size_t         RecordingAlignment = 8;
+inline constexpr std::array<char, 8> RecordingMagic     = {'L', 'S', 'P', 'R', 'E', 'C', 'O', 'R'};
+inline constexpr std::uint32_t       RecordingVersion   = 1;
+
+struct RecordingFileHeader{
+	std::array<char, 8> magic     = RecordingMagic;
+	std::uint32_t       version   = RecordingVersion;
+	std::uint32_t       reserved  = 0;
+	std::int64_t        startTime = 0; // Nanoseconds since the system clock epoch
+};
+
+struct RecordedMessageHeader{
+	std::int64_t     timestamp = 0; // Nanoseconds since the start of the recording
+	std::uint32_t    size      = 0; // Size of the message without padding
+	MessageDirection direction = MessageDirection::Incoming;
+};
+
+static_assert(sizeof(RecordingFileHeader) % RecordingAlignment == 0);
+static_assert(sizeof(RecordedMessageHeader) % RecordingAlignment == 0);
+
+/*
+ * Stream decorator that passes all data through to another stream and writes every complete message
+ * in either direction to a recording file.
+ * Every message is flushed to the file once it is complete so nothing is lost if the process exits abnormally.
+ * Reads and writes may happen concurrently from different threads.
+ */
+class RecordingStream : public Stream{
+public:
+	// Throws lsp::io::Error if the recording file could not be created
+	RecordingStream(Stream& stream, const std::string& recordingFilePath);
+	~RecordingStream() override;
+
+	void read(char* buffer, std::size_t size) override;
+	void write(const char* buffer, std::size_t size) override;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> m_impl;
+};
+
+/*
+ * Read only view of a recording file.
+ * The file is memory mapped and messages refer to the mapped data directly.
+ */
+class Recording{
+public:
+	struct Message{
+		std::chrono::nanoseconds timestamp;
+		MessageDirection         direction;
+		std::string_view         data;
+	};
+
+	// Throws lsp::io::Error if the file could not be opened or is not a valid recording
+	explicit Recording(const std::string& path);
+	Recording(Recording&&) noexcept;
+	Recording& operator=(Recording&&) noexcept;
+	~Recording();
+
+	[[nodiscard]] std::chrono::system_clock::time_point startTime() const;
+	[[nodiscard]] const std::vector<Message>& messages() const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace lsp::io
@@ -3,14 +3,21 @@
 #ifndef LSP_SOCKET_UNSUPPORTED
 
 #include <cassert>
+#include <lsp/io/uring.h>
+
+#if defined(LSP_USE_IO_URING) && defined(LSP_SOCKET_POSIX) && !defined(LSP_URING_UNSUPPORTED)
+	#define LSP_SOCKET_URING
+#endif
 
 #ifdef LSP_SOCKET_POSIX
 #include <cerrno>
 #include <netdb.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #elif defined LSP_SOCKET_WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -49,10 +56,16 @@ struct Socket::Impl{
 
 	SocketHandle   m_socketFd       = InvalidSocket;
 	unsigned short m_maxConnections = 1; // Only relevant for listen
+	SocketOptions  m_options;            // Only relevant for listen - Applied to accepted sockets
+#ifdef LSP_SOCKET_URING
+	LazyUring      m_readRing;
+	LazyUring      m_writeRing;
+#endif
 
-	Impl(SocketHandle socket, unsigned short maxConnections = 1)
+	Impl(SocketHandle socket, unsigned short maxConnections = 1, const SocketOptions& options = {})
 		: m_socketFd(socket)
 		, m_maxConnections(maxConnections)
+		, m_options(options)
 	{
 	}
 
@@ -101,7 +114,7 @@ struct Socket::Impl{
 	}
 
 	[[nodiscard]]
-	static std::unique_ptr<Impl> setupForListen(unsigned short port, unsigned short maxConnections)
+	static std::unique_ptr<Impl> setupForListen(unsigned short port, unsigned short maxConnections, const SocketOptions& options)
 	{
 		ensureInitialized();
 
@@ -110,6 +123,8 @@ struct Socket::Impl{
 		if(socketFd == InvalidSocket)
 			throwError("Failed to create socket");
 
+		auto impl = std::make_unique<Impl>(socketFd, maxConnections, options);
+
 #ifdef LSP_SOCKET_POSIX
 		const int yes = 1;
 #elif defined(LSP_SOCKET_WIN32)
@@ -117,22 +132,28 @@ struct Socket::Impl{
 #endif
 		setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
 
+		// Buffer sizes need to be set before listening so the TCP window scale can be negotiated
+		impl->setBufferSizes(options);
+		// The connection options are only needed on accepted sockets. They are set here as well so an
+		// invalid configuration fails now instead of rejecting every connection.
+		impl->setConnectionOptions(options);
+
 		auto addr = sockaddr_in{};
 		addr.sin_family      = AF_INET;
 		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 		addr.sin_port        = htons(port);
 
 		if(bind(socketFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
-		{
-			closeSocketHandle(socketFd);
 			throwError("Failed to bind socket address");
-		}
 
-		return std::make_unique<Impl>(socketFd, maxConnections);
+		if(::listen(socketFd, maxConnections) != 0)
+			throwError("Failed to listen for new socket connections");
+
+		return impl;
 	}
 
 	[[nodiscard]]
-	static std::unique_ptr<Impl> connect(const std::string& address, unsigned short port)
+	static std::unique_ptr<Impl> connect(const std::string& address, unsigned short port, const SocketOptions& options)
 	{
 		ensureInitialized();
 
@@ -145,6 +166,8 @@ struct Socket::Impl{
 		if(auto status = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &addrInfoList); status != 0)
 			throwError("getaddrinfo: " + std::to_string(status));
 
+		const auto addrInfoGuard = std::unique_ptr<addrinfo, decltype(&freeaddrinfo)>(addrInfoList, freeaddrinfo);
+
 		for(const auto* addr = addrInfoList; addr; addr = addr->ai_next)
 		{
 			const auto socketFd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
@@ -152,17 +175,24 @@ struct Socket::Impl{
 			if(socketFd == InvalidSocket)
 				continue;
 
-			if(::connect(socketFd, addr->ai_addr, static_cast<SizeType>(addr->ai_addrlen)) == 0)
+			auto impl = std::make_unique<Impl>(socketFd);
+
+			// An option that can't be set for this address might work for the next one like a failed connection
+			try
 			{
-				freeaddrinfo(addrInfoList);
-				return std::make_unique<Impl>(socketFd);
-			}
+				impl->setBufferSizes(options);
 
-			closeSocketHandle(socketFd);
+				if(::connect(socketFd, addr->ai_addr, static_cast<SizeType>(addr->ai_addrlen)) == 0)
+				{
+					impl->setConnectionOptions(options);
+					return impl;
+				}
+			}
+			catch(const Error&)
+			{
+			}
 		}
 
-		freeaddrinfo(addrInfoList);
-
 		throwError("Failed to connect to any resolved address");
 	}
 
@@ -170,15 +200,117 @@ struct Socket::Impl{
 	{
 		assert(m_socketFd != InvalidSocket);
 
-		if(::listen(m_socketFd, m_maxConnections) == -1)
-			throwError("Failed to listen for new socket connections");
+		auto other = accept(m_socketFd, nullptr, nullptr);
+
+		while(other == InvalidSocket)
+		{
+			if(wouldBlock())
+				return nullptr;
+
+			if(!acceptWasAborted())
+				throwError("Failed to accept socket connection");
+
+			other = accept(m_socketFd, nullptr, nullptr);
+		}
+
+		auto impl = std::make_unique<Impl>(other);
+
+		// The options were validated on the listening socket. If one can't be set anyway,
+		// e.g. because the peer has already reset the connection, it is used without it.
+		try
+		{
+			impl->setBufferSizes(m_options);
+			impl->setConnectionOptions(m_options);
+		}
+		catch(const Error&)
+		{
+		}
+
+		return impl;
+	}
+
+	void setOption(int level, int name, int value, const char* optionName)
+	{
+		if(setsockopt(m_socketFd, level, name, reinterpret_cast<const char*>(&value), sizeof(value)) != 0)
+			throwError(std::string("Failed to set socket option ") + optionName);
+	}
+
+	void setBufferSizes(const SocketOptions& options)
+	{
+		if(options.sendBufferSize > 0)
+			setOption(SOL_SOCKET, SO_SNDBUF, options.sendBufferSize, "SO_SNDBUF");
+
+		if(options.receiveBufferSize > 0)
+			setOption(SOL_SOCKET, SO_RCVBUF, options.receiveBufferSize, "SO_RCVBUF");
+	}
+
+	void setConnectionOptions(const SocketOptions& options)
+	{
+		if(options.noDelay)
+			setOption(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+#ifdef SO_BUSY_POLL
+		if(options.busyPollMicroseconds > 0)
+			setOption(SOL_SOCKET, SO_BUSY_POLL, options.busyPollMicroseconds, "SO_BUSY_POLL");
+#endif
+
+		if(!options.keepAlive)
+			return;
+
+		setOption(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
 
-		const auto other = accept(m_socketFd, nullptr, nullptr);
+#if defined(TCP_KEEPIDLE)
+		if(options.keepAliveIdleSeconds > 0)
+			setOption(IPPROTO_TCP, TCP_KEEPIDLE, options.keepAliveIdleSeconds, "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+		if(options.keepAliveIdleSeconds > 0)
+			setOption(IPPROTO_TCP, TCP_KEEPALIVE, options.keepAliveIdleSeconds, "TCP_KEEPALIVE");
+#endif
+
+#ifdef TCP_KEEPINTVL
+		if(options.keepAliveIntervalSeconds > 0)
+			setOption(IPPROTO_TCP, TCP_KEEPINTVL, options.keepAliveIntervalSeconds, "TCP_KEEPINTVL");
+#endif
+
+#ifdef TCP_KEEPCNT
+		if(options.keepAliveProbeCount > 0)
+			setOption(IPPROTO_TCP, TCP_KEEPCNT, options.keepAliveProbeCount, "TCP_KEEPCNT");
+#endif
+	}
+
+	void setNonBlocking(bool nonBlocking)
+	{
+#ifdef LSP_SOCKET_POSIX
+		const auto flags = fcntl(m_socketFd, F_GETFL, 0);
+
+		if(flags == -1 || fcntl(m_socketFd, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == -1)
+			throwError("Failed to change socket blocking mode");
+#elif defined(LSP_SOCKET_WIN32)
+		u_long mode = nonBlocking ? 1 : 0;
 
-		if(other == InvalidSocket)
-			throwError("Failed to accept socket connection");
+		if(ioctlsocket(m_socketFd, FIONBIO, &mode) != 0)
+			throwError("Failed to change socket blocking mode");
+#endif
+	}
 
-		return std::make_unique<Impl>(other);
+	// The pending connection went away before it could be accepted. There might be others.
+	static bool acceptWasAborted()
+	{
+#ifdef LSP_SOCKET_POSIX
+		return errno == ECONNABORTED || errno == EINTR || errno == EPROTO;
+#elif defined(LSP_SOCKET_WIN32)
+		const auto error = WSAGetLastError();
+		return error == WSAECONNRESET || error == WSAEINTR;
+#endif
+	}
+
+	static bool wouldBlock()
+	{
+#ifdef LSP_SOCKET_POSIX
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#elif defined(LSP_SOCKET_WIN32)
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif
 	}
 
 	void read(char* buffer, std::size_t size)
@@ -186,6 +318,14 @@ struct Socket::Impl{
 		if(size == 0)
 			return;
 
+#ifdef LSP_SOCKET_URING
+		if(auto* const ring = m_readRing.get())
+		{
+			ring->read(m_socketFd, buffer, size);
+			return;
+		}
+#endif
+
 		SizeType totalBytesRead = 0;
 
 		while(totalBytesRead < static_cast<SizeType>(size))
@@ -207,6 +347,14 @@ struct Socket::Impl{
 		if(size == 0)
 			return;
 
+#ifdef LSP_SOCKET_URING
+		if(auto* const ring = m_writeRing.get())
+		{
+			ring->write(m_socketFd, buffer, size);
+			return;
+		}
+#endif
+
 		SizeType totalBytesWritten = 0;
 
 		while(totalBytesWritten < static_cast<SizeType>(size))
@@ -237,9 +385,14 @@ Socket::Socket(std::unique_ptr<Impl> impl)
 {
 }
 
-Socket Socket::connect(const std::string& address, unsigned short port)
+Socket Socket::connect(const std::string& address, unsigned short port, const SocketOptions& options)
 {
-	return Socket(Impl::connect(address, port));
+	return Socket(Impl::connect(address, port, options));
+}
+
+Socket Socket::fromNativeHandle(NativeHandle handle)
+{
+	return Socket(std::make_unique<Impl>(static_cast<Impl::SocketHandle>(handle)));
 }
 
 bool Socket::isOpen() const
@@ -247,6 +400,18 @@ bool Socket::isOpen() const
 	return !!m_impl;
 }
 
+Socket::NativeHandle Socket::nativeHandle() const
+{
+	assert(m_impl);
+	return static_cast<NativeHandle>(m_impl->m_socketFd);
+}
+
+void Socket::setNonBlocking(bool nonBlocking)
+{
+	assert(m_impl);
+	m_impl->setNonBlocking(nonBlocking);
+}
+
 void Socket::close()
 {
 	m_impl.reset();
@@ -268,8 +433,8 @@ void Socket::write(const char* buffer, std::size_t size)
  * SocketListener
  */
 
-SocketListener::SocketListener(unsigned short port, unsigned short maxConnections)
-	: m_socket(Socket::Impl::setupForListen(port, maxConnections))
+SocketListener::SocketListener(unsigned short port, unsigned short maxConnections, const SocketOptions& options)
+	: m_socket(Socket::Impl::setupForListen(port, maxConnections, options))
 {
 }
 
@@ -10,12 +10,32 @@
 
 #ifndef LSP_SOCKET_UNSUPPORTED
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <lsp/io/stream.h>
 
 namespace lsp::io{
 
+/*
+ * SocketOptions
+ * Values of 0 keep the system default.
+ */
+
+struct SocketOptions{
+	bool noDelay                  = false; // TCP_NODELAY - Send small messages immediately instead of coalescing them
+	int  sendBufferSize           = 0;     // SO_SNDBUF
+	int  receiveBufferSize        = 0;     // SO_RCVBUF
+	int  busyPollMicroseconds     = 0;     // SO_BUSY_POLL - Only supported on Linux and ignored elsewhere
+	bool keepAlive                = false; // SO_KEEPALIVE
+	int  keepAliveIdleSeconds     = 0;     // Idle time before the first keepalive probe is sent
+	int  keepAliveIntervalSeconds = 0;     // Time between keepalive probes
+	int  keepAliveProbeCount      = 0;     // Unanswered probes before the connection is dropped
+
+	// Low latency settings for small request/response pairs
+	[[nodiscard]] static SocketOptions lowLatency(){ return {.noDelay = true}; }
+};
+
 /*
  * Socket
  */
@@ -24,15 +44,28 @@ class Socket : public Stream{
 public:
 	static constexpr auto Localhost = "127.0.0.1";
 
+#ifdef LSP_SOCKET_POSIX
+	using NativeHandle = int;
+#elif defined(LSP_SOCKET_WIN32)
+	using NativeHandle = std::uintptr_t;
+#endif
+
 	Socket(Socket&&) noexcept;
 	Socket& operator=(Socket&&) noexcept;
 	~Socket() override;
 
-	[[nodiscard]] static Socket connect(const std::string& address, unsigned short port);
+	[[nodiscard]] static Socket connect(const std::string& address, unsigned short port, const SocketOptions& options = {});
+	// Takes ownership of a connected socket that was created elsewhere, e.g. one end of a socketpair
+	[[nodiscard]] static Socket fromNativeHandle(NativeHandle handle);
 
 	[[nodiscard]] bool isOpen() const;
+	[[nodiscard]] NativeHandle nativeHandle() const;
 	void close();
 
+	// Non-blocking sockets are meant to be used with a readiness API like lsp::io::EventLoop.
+	// read and write throw if the operation would block.
+	void setNonBlocking(bool nonBlocking);
+
 	void read(char* buffer, std::size_t size) override;
 	void write(const char* buffer, std::size_t size) override;
 
@@ -50,10 +83,18 @@ private:
 
 class SocketListener{
 public:
-	SocketListener(unsigned short port, unsigned short maxConnections = 32);
-
+	// The options are applied to the listening socket, which throws lsp::io::Error if one of them is invalid,
+	// and to every accepted socket.
+	SocketListener(unsigned short port, unsigned short maxConnections = 32, const SocketOptions& options = {});
+
+	// Waits for a new connection. If the listener is non-blocking and there is
+	// no pending connection a socket is returned that is not open.
+	// Connections that are aborted before they could be accepted are skipped.
+	// Other failures throw lsp::io::Error, e.g. when the process has run out of descriptors.
 	[[nodiscard]] Socket listen();
 	[[nodiscard]] bool isReady() const{ return m_socket.isOpen(); }
+	[[nodiscard]] Socket::NativeHandle nativeHandle() const{ return m_socket.nativeHandle(); }
+	void setNonBlocking(bool nonBlocking){ m_socket.setNonBlocking(nonBlocking); }
 	void shutdown(){ m_socket.close(); }
 
 private:
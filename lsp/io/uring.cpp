@@ -0,0 +1,319 @@
+#include <lsp/io/uring.h>
+
+#ifndef LSP_URING_UNSUPPORTED
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lsp::io{
+namespace{
+
+int ioUringSetup(unsigned entries, io_uring_params* params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int ringFd, unsigned opcode, const void* arg, unsigned argCount)
+{
+	return static_cast<int>(syscall(__NR_io_uring_register, ringFd, opcode, arg, argCount));
+}
+
+[[noreturn]] void throwError(const std::string& msg, int error)
+{
+	throw Error(msg + ": " + std::strerror(error));
+}
+
+} // namespace
+
+/*
+ * Uring::Impl
+ */
+
+struct Uring::Impl{
+	int              m_ringFd       = -1;
+	void*            m_sqRing       = MAP_FAILED;
+	void*            m_cqRing       = MAP_FAILED;
+	std::size_t      m_sqRingSize   = 0;
+	std::size_t      m_cqRingSize   = 0;
+	io_uring_sqe*    m_sqes         = static_cast<io_uring_sqe*>(MAP_FAILED);
+	std::size_t      m_sqesSize     = 0;
+	unsigned*        m_sqTail       = nullptr;
+	unsigned*        m_sqMask       = nullptr;
+	unsigned*        m_sqArray      = nullptr;
+	unsigned*        m_cqHead       = nullptr;
+	unsigned*        m_cqTail       = nullptr;
+	unsigned*        m_cqMask       = nullptr;
+	io_uring_cqe*    m_cqes         = nullptr;
+	char*            m_memory       = static_cast<char*>(MAP_FAILED);
+	std::size_t      m_chunkSize    = 0;
+	unsigned         m_chunkCount   = 0;
+	std::uint64_t    m_fileOffset   = 0;
+	std::vector<int> m_results;
+	// Data that was read ahead into m_memory
+	std::size_t      m_readPos      = 0;
+	std::size_t      m_readEnd      = 0;
+
+	Impl(std::size_t chunkSize, unsigned chunkCount)
+		: m_chunkSize{chunkSize}
+		, m_chunkCount{chunkCount}
+		, m_results(chunkCount)
+	{
+	}
+
+	~Impl()
+	{
+		if(m_memory != MAP_FAILED)
+			munmap(m_memory, memorySize());
+
+		if(m_sqes != MAP_FAILED)
+			munmap(m_sqes, m_sqesSize);
+
+		if(m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+			munmap(m_cqRing, m_cqRingSize);
+
+		if(m_sqRing != MAP_FAILED)
+			munmap(m_sqRing, m_sqRingSize);
+
+		if(m_ringFd != -1)
+			close(m_ringFd);
+	}
+
+	std::size_t memorySize() const{ return m_chunkSize * m_chunkCount; }
+
+	bool init()
+	{
+		auto params = io_uring_params{};
+		m_ringFd = ioUringSetup(m_chunkCount, &params);
+
+		if(m_ringFd < 0)
+			return false;
+
+		// Non-seekable files like pipes and sockets ignore the offset. -1 selects the current file position if supported.
+		if(params.features & IORING_FEAT_RW_CUR_POS)
+			m_fileOffset = static_cast<std::uint64_t>(-1);
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+		if(singleMmap)
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+		m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+
+		if(m_sqRing == MAP_FAILED)
+			return false;
+
+		m_cqRing = singleMmap ? m_sqRing : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+
+		if(m_cqRing == MAP_FAILED)
+			return false;
+
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes     = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES));
+
+		if(m_sqes == MAP_FAILED)
+			return false;
+
+		auto* const sq = static_cast<char*>(m_sqRing);
+		m_sqTail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_sqMask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+		auto* const cq = static_cast<char*>(m_cqRing);
+		m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_cqes   = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		m_memory = static_cast<char*>(mmap(nullptr, memorySize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+		if(m_memory == MAP_FAILED)
+			return false;
+
+		// Registering fails if the memory lock limit is too low in which case io_uring isn't used at all
+		const auto buffer = iovec{m_memory, memorySize()};
+		return ioUringRegister(m_ringFd, IORING_REGISTER_BUFFERS, &buffer, 1) == 0;
+	}
+
+	void pushFixed(std::uint8_t opcode, int fd, char* data, std::size_t size, unsigned index, bool link)
+	{
+		const auto tail = *m_sqTail;
+		const auto idx  = tail & *m_sqMask;
+		auto&      sqe  = m_sqes[idx];
+
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode    = opcode;
+		sqe.fd        = fd;
+		sqe.addr      = reinterpret_cast<std::uint64_t>(data);
+		sqe.len       = static_cast<std::uint32_t>(size);
+		sqe.off       = m_fileOffset;
+		sqe.buf_index = 0;
+		sqe.flags     = link ? IOSQE_IO_LINK : 0;
+		sqe.user_data = index;
+
+		m_sqArray[idx] = idx;
+		std::atomic_ref(*m_sqTail).store(tail + 1, std::memory_order_release);
+	}
+
+	// Submits all pushed requests with a single system call and waits for their completion
+	void submitAndWait(unsigned count)
+	{
+		auto toSubmit  = count;
+		auto completed = 0u;
+
+		while(completed < count)
+		{
+			const auto result = ioUringEnter(m_ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+
+			if(result < 0)
+			{
+				if(errno == EINTR)
+					continue;
+
+				throwError("io_uring_enter failed", errno);
+			}
+
+			toSubmit -= std::min(toSubmit, static_cast<unsigned>(result));
+
+			auto       head = *m_cqHead;
+			const auto tail = std::atomic_ref(*m_cqTail).load(std::memory_order_acquire);
+
+			for(; head != tail; ++head)
+			{
+				const auto& cqe = m_cqes[head & *m_cqMask];
+				m_results[cqe.user_data] = cqe.res;
+				++completed;
+			}
+
+			std::atomic_ref(*m_cqHead).store(head, std::memory_order_release);
+		}
+	}
+
+	void read(int fd, char* buffer, std::size_t size)
+	{
+		while(size > 0)
+		{
+			if(m_readPos == m_readEnd)
+			{
+				pushFixed(IORING_OP_READ_FIXED, fd, m_memory, memorySize(), 0, false);
+				submitAndWait(1);
+
+				const auto result = m_results[0];
+
+				if(result == -EINTR)
+					continue;
+
+				if(result < 0)
+					throwError("Failed to read", -result);
+
+				if(result == 0)
+					throw Error("Failed to read: End of file");
+
+				m_readPos = 0;
+				m_readEnd = static_cast<std::size_t>(result);
+			}
+
+			const auto bytesRead = std::min(size, m_readEnd - m_readPos);
+			std::memcpy(buffer, m_memory + m_readPos, bytesRead);
+			m_readPos += bytesRead;
+			buffer += bytesRead;
+			size -= bytesRead;
+		}
+	}
+
+	void write(int fd, const char* buffer, std::size_t size)
+	{
+		while(size > 0)
+		{
+			auto count  = 0u;
+			auto offset = std::size_t(0);
+
+			for(; count < m_chunkCount && offset < size; ++count)
+			{
+				const auto chunkSize = std::min(m_chunkSize, size - offset);
+				auto* const chunk    = m_memory + count * m_chunkSize;
+				std::memcpy(chunk, buffer + offset, chunkSize);
+				offset += chunkSize;
+				pushFixed(IORING_OP_WRITE_FIXED, fd, chunk, chunkSize, count, offset < size && count + 1 < m_chunkCount);
+			}
+
+			submitAndWait(count);
+
+			// A short write breaks the chain. Continue after the last byte that was actually written.
+			auto bytesWritten = std::size_t(0);
+
+			for(auto i = 0u; i < count; ++i)
+			{
+				const auto result    = m_results[i];
+				const auto chunkSize = std::min(m_chunkSize, size - i * m_chunkSize);
+
+				if(result < 0)
+				{
+					if(i == 0 && result != -EINTR)
+						throwError("Failed to write", -result);
+
+					break;
+				}
+
+				bytesWritten += static_cast<std::size_t>(result);
+
+				if(static_cast<std::size_t>(result) < chunkSize)
+					break;
+			}
+
+			buffer += bytesWritten;
+			size -= bytesWritten;
+		}
+	}
+};
+
+/*
+ * Uring
+ */
+
+Uring::Uring(std::unique_ptr<Impl> impl)
+	: m_impl{std::move(impl)}
+{
+}
+
+Uring::~Uring() = default;
+
+std::unique_ptr<Uring> Uring::create(std::size_t chunkSize, unsigned chunkCount)
+{
+	auto impl = std::make_unique<Impl>(std::max(chunkSize, std::size_t(1)), std::max(chunkCount, 1u));
+
+	if(!impl->init())
+		return nullptr;
+
+	return std::unique_ptr<Uring>(new Uring(std::move(impl)));
+}
+
+void Uring::read(int fd, char* buffer, std::size_t size)
+{
+	m_impl->read(fd, buffer, size);
+}
+
+void Uring::write(int fd, const char* buffer, std::size_t size)
+{
+	m_impl->write(fd, buffer, size);
+}
+
+} // namespace lsp::io
+
+#endif // LSP_URING_UNSUPPORTED
@@ -0,0 +1,71 @@
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+	#define LSP_URING_SUPPORTED
+#else
+	#define LSP_URING_UNSUPPORTED
+#endif
+
+#ifndef LSP_URING_UNSUPPORTED
+
+#include <cstddef>
+#include <memory>
+#include <lsp/io/stream.h>
+
+namespace lsp::io{
+
+/*
+ * Uring
+ *
+ * Minimal io_uring wrapper that performs blocking reads and writes on a file descriptor with fewer system calls.
+ * Memory registered with the kernel once is used for all transfers:
+ *  - Reads fill the whole registered buffer with whatever data is available and serve subsequent reads from it.
+ *  - Writes are split into chunks that are submitted as a linked batch using a single system call.
+ * A Uring instance is not thread safe. Use one instance per direction if reads and writes happen concurrently.
+ */
+class Uring{
+public:
+	static constexpr std::size_t DefaultChunkSize  = 64 * 1024;
+	static constexpr unsigned    DefaultChunkCount = 4;
+
+	~Uring();
+
+	// Returns nullptr if io_uring is not available on the running system
+	[[nodiscard]] static std::unique_ptr<Uring> create(std::size_t chunkSize = DefaultChunkSize, unsigned chunkCount = DefaultChunkCount);
+
+	// Throws lsp::io::Error if the end of the file was reached before size bytes could be read
+	void read(int fd, char* buffer, std::size_t size);
+	void write(int fd, const char* buffer, std::size_t size);
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> m_impl;
+
+	Uring(std::unique_ptr<Impl> impl);
+};
+
+/*
+ * Creates a Uring on first use so streams that never read or write don't allocate one.
+ * get returns nullptr if io_uring is unavailable in which case the caller should fall back to regular system calls.
+ */
+class LazyUring{
+public:
+	[[nodiscard]] Uring* get()
+	{
+		if(!m_initialized)
+		{
+			m_uring       = Uring::create();
+			m_initialized = true;
+		}
+
+		return m_uring.get();
+	}
+
+private:
+	std::unique_ptr<Uring> m_uring;
+	bool                   m_initialized = false;
+};
+
+} // namespace lsp::io
+
+#endif // LSP_URING_UNSUPPORTED
@@ -4,7 +4,26 @@
 namespace lsp{
 namespace{
 
-thread_local const MessageId* t_currentRequestId = nullptr;
+thread_local const MessageId*         t_currentRequestId         = nullptr;
+thread_local const CancellationToken* t_currentCancellationToken = nullptr;
+thread_local bool                     t_runningSerially          = false;
+
+constexpr auto CancelRequestMethod = std::string_view("$/cancelRequest");
+
+std::string supersedeKey(std::string_view method, const HandlerOptions& options, const std::optional<json::Value>& params)
+{
+	if(!options.supersedeKey)
+		return {};
+
+	static const json::Value NullParams = json::Null();
+	auto key = options.supersedeKey(params.has_value() ? *params : NullParams);
+
+	if(!key.has_value())
+		return {};
+
+	// Handlers can be shared between methods so the method is part of the key
+	return std::string(method) + '\n' + *key;
+}
 
 json::Integer nextUniqueRequestId()
 {
@@ -12,12 +31,128 @@ json::Integer nextUniqueRequestId()
 	return ++s_uniqueRequestId;
 }
 
+std::optional<std::string> serialKey(const HandlerOptions& options, const std::optional<json::Value>& params)
+{
+	if(!options.serialKey)
+		return std::nullopt;
+
+	static const json::Value NullParams = json::Null();
+	return options.serialKey(params.has_value() ? *params : NullParams);
+}
+
+json::Value histogramJson(const Histogram::Snapshot& histogram, double scale)
+{
+	auto json = json::Object();
+	json["count"] = static_cast<json::Decimal>(histogram.count);
+	json["mean"]  = histogram.mean() * scale;
+	json["p50"]   = static_cast<json::Decimal>(histogram.percentile(50.0)) * scale;
+	json["p90"]   = static_cast<json::Decimal>(histogram.percentile(90.0)) * scale;
+	json["p99"]   = static_cast<json::Decimal>(histogram.percentile(99.0)) * scale;
+	json["max"]   = static_cast<json::Decimal>(histogram.max) * scale;
+
+	return json;
+}
+
+json::Value metricsJson(const std::vector<MessageMetrics::MethodSnapshot>& metrics)
+{
+	// Durations are converted from nanoseconds to microseconds
+	constexpr auto Microseconds = 1.0 / 1000.0;
+	auto           methods      = json::Object();
+
+	for(const auto& method : metrics)
+	{
+		auto json = json::Object();
+		json["received"]            = static_cast<json::Decimal>(method.receivedCount);
+		json["sent"]                = static_cast<json::Decimal>(method.sentCount);
+		json["queueWaitUs"]         = histogramJson(method.queueWait, Microseconds);
+		json["handlerTimeUs"]       = histogramJson(method.handlerTime, Microseconds);
+		json["parseTimeUs"]         = histogramJson(method.parseTime, Microseconds);
+		json["serializationTimeUs"] = histogramJson(method.serializationTime, Microseconds);
+		json["receivedBytes"]       = histogramJson(method.receivedBytes, 1.0);
+		json["sentBytes"]           = histogramJson(method.sentBytes, 1.0);
+		methods[method.method] = std::move(json);
+	}
+
+	auto result = json::Object();
+	result["methods"] = std::move(methods);
+
+	return result;
+}
+
+struct SerialScope{
+	SerialScope(){ t_runningSerially = true; }
+	~SerialScope(){ t_runningSerially = false; }
+	SerialScope(const SerialScope&) = delete;
+	SerialScope& operator=(const SerialScope&) = delete;
+};
+
 }
 
 MessageHandler::MessageHandler(Connection& connection, unsigned int maxResponseThreads)
+	: MessageHandler(connection, ThreadPoolOptions{.minThreads = 0, .maxThreads = maxResponseThreads})
+{
+}
+
+MessageHandler::MessageHandler(Connection& connection, const ThreadPoolOptions& threadPoolOptions)
 	: m_connection{connection}
-	, m_threadPool(0, maxResponseThreads)
+	, m_ownedThreadPool{std::make_unique<ThreadPool>(threadPoolOptions)}
+	, m_threadPool{*m_ownedThreadPool}
+	, m_serialExecutor{m_threadPool}
+	, m_requestHandlerTable{std::make_unique<const HandlerTable>()}
 {
+	m_requestHandlers.store(m_requestHandlerTable.get());
+}
+
+MessageHandler::MessageHandler(Connection& connection, ThreadPool& threadPool)
+	: m_connection{connection}
+	, m_threadPool{threadPool}
+	, m_serialExecutor{m_threadPool}
+	, m_requestHandlerTable{std::make_unique<const HandlerTable>()}
+{
+	m_requestHandlers.store(m_requestHandlerTable.get());
+}
+
+MessageHandler::~MessageHandler()
+{
+	// Waits for promise callbacks that are running and turns later ones into no-ops
+	{
+		const auto lock = std::lock_guard(m_liveness->mutex);
+		m_liveness->alive = false;
+	}
+
+	// Timeouts that have not expired yet are dropped
+	{
+		std::lock_guard lock{m_pendingRequestsMutex};
+
+		for(const auto& [id, pending] : m_pendingRequests)
+		{
+			if(pending.timeout != TimerWheel::InvalidTimerId)
+				m_threadPool.cancelTimer(pending.timeout);
+		}
+	}
+
+	// Worker tasks use the other members. A shared pool keeps running the tasks of other handlers,
+	// so only the ones that were posted by this handler are waited for.
+	if(m_ownedThreadPool)
+		m_ownedThreadPool->waitUntilFinished();
+
+	waitForTrackedTasks();
+}
+
+ThreadPool::Stats MessageHandler::threadPoolStats() const
+{
+	return m_threadPool.stats();
+}
+
+bool MessageHandler::hasPendingTasks() const
+{
+	const auto lock = std::lock_guard(m_trackedTasksMutex);
+	return m_trackedTaskCount > 0;
+}
+
+std::vector<MessageMetrics::MethodSnapshot> MessageHandler::metrics() const
+{
+	return m_connection.metrics().snapshot();
 }
 
 void MessageHandler::processIncomingMessages()
@@ -28,38 +163,54 @@ void MessageHandler::processIncomingMessages()
 	{
 		if(auto* const request = std::get_if<jsonrpc::Request>(message))
 		{
-			auto optionalResponse = processRequest(std::move(*request), true);
+			const auto traceScope = TraceScope(request->method, request->id.has_value() ? &*request->id : nullptr);
+			auto optionalResponse = processRequest(std::move(*request), nullptr);
 
+			// Only the params of the request were moved
 			if(optionalResponse.has_value())
-				m_connection.writeMessage(std::move(*optionalResponse));
+				sendResponse(std::move(*optionalResponse), &m_connection.metrics().method(request->method));
 		}
 		else
 		{
-			processResponse(std::move(std::get<jsonrpc::Response>(*message)));
+			auto&      response   = std::get<jsonrpc::Response>(*message);
+			const auto traceScope = TraceScope({}, &response.id);
+			processResponse(std::move(response));
 		}
 	}
 	else
 	{
+		// Members are dispatched like single messages. Asynchronous requests run concurrently on the
+		// thread pool and the combined response is written by whichever thread finishes the last one.
 		auto& batch         = std::get<jsonrpc::MessageBatch>(messageOrBatch);
-		auto  responseBatch = jsonrpc::MessageBatch();
+		auto  responseBatch = std::make_shared<ResponseBatch>();
 
 		for(auto& msg : batch)
 		{
 			if(auto* const request = std::get_if<jsonrpc::Request>(&msg))
 			{
-				auto optionalResponse = processRequest(std::move(*request), false);
+				const auto traceScope = TraceScope(request->method, request->id.has_value() ? &*request->id : nullptr);
+
+				if(!request->isNotification())
+				{
+					const auto lock = std::lock_guard(responseBatch->mutex);
+					++responseBatch->pendingCount;
+				}
+
+				auto optionalResponse = processRequest(std::move(*request), responseBatch);
 
 				if(optionalResponse.has_value())
-					responseBatch.push_back(std::move(*optionalResponse));
+					addBatchResponse(*responseBatch, std::move(optionalResponse));
 			}
 			else
 			{
-				processResponse(std::move(std::get<jsonrpc::Response>(msg)));
+				auto&      response   = std::get<jsonrpc::Response>(msg);
+				const auto traceScope = TraceScope({}, &response.id);
+				processResponse(std::move(response));
 			}
 		}
 
-		if(!responseBatch.empty())
-			m_connection.writeMessage(std::move(responseBatch));
+		// Release the reference held while the batch was being dispatched
+		addBatchResponse(*responseBatch, std::nullopt);
 	}
 }
 
@@ -72,73 +223,69 @@ const MessageId& MessageHandler::currentRequestId()
 	return *t_currentRequestId;
 }
 
+const CancellationToken& MessageHandler::currentCancellationToken()
+{
+	assert(t_currentCancellationToken);
+	if(!t_currentCancellationToken)
+		throw std::logic_error("MessageHandler::currentCancellationToken called outside of a request context");
+
+	return *t_currentCancellationToken;
+}
+
 void MessageHandler::remove(std::string_view method)
 {
 	std::lock_guard lock{m_requestHandlersMutex};
 
-	if(const auto it = m_requestHandlersByMethod.find(method); it != m_requestHandlersByMethod.end())
-		m_requestHandlersByMethod.erase(it);
+	if(!m_requestHandlerTable->find(method))
+		return;
+
+	auto table = std::make_unique<HandlerTable>(*m_requestHandlerTable);
+	table->set(method, nullptr);
+	publishHandlerTable(std::move(table));
 }
 
-MessageHandler::OptionalResponse MessageHandler::processRequest(jsonrpc::Request&& request, bool allowAsync)
+MessageHandler::OptionalResponse MessageHandler::processRequest(jsonrpc::Request&& request, const ResponseBatchPtr& batch)
 {
-	std::unique_lock lock{m_requestHandlersMutex};
 	OptionalResponse response;
 
-	if(const auto handlerIt = m_requestHandlersByMethod.find(request.method);
-	   handlerIt != m_requestHandlersByMethod.end() && handlerIt->second)
-	{
-		assert(!t_currentRequestId);
-		if(request.id.has_value())
-		{
-			t_currentRequestId = &request.id.value();
-		}
-		else
-		{
-			static const MessageId NullMessageId = json::Null();
-			t_currentRequestId = &NullMessageId;
-		}
-
-		try
-		{
-			lock.unlock();
+	// Cancellation is handled here but the notification is still passed on to a registered handler
+	if(request.method == CancelRequestMethod && request.isNotification())
+		cancelRequest(request.params);
 
-			// Call handler for the method type and return optional response
-			response = handlerIt->second(
-				request.params.has_value() ? std::move(*request.params) : json::Null{},
-				allowAsync);
-		}
-		catch(const RequestError& e)
-		{
-			if(!request.isNotification())
-			{
-				response = jsonrpc::createErrorResponse(
-					*request.id, e.code(), e.what(), e.data());
-			}
-		}
-		catch(const json::TypeError& e)
+	if(const auto handler = findHandler(request.method); handler && handler->call)
+	{
+		static const MessageId NullMessageId = json::Null();
+		const auto& id     = request.id.has_value() ? *request.id : NullMessageId;
+		const auto  token  = request.isNotification() ? CancellationToken() :
+		                     beginRequest(id, supersedeKey(request.method, handler->options, request.params));
+		const auto  key    = serialKey(handler->options, request.params);
+		auto        params = request.params.has_value() ? std::move(*request.params) : json::Value(json::Null{});
+
+		if(key.has_value())
 		{
-			if(!request.isNotification())
+			// The response is sent by the worker thread
+			m_serialExecutor.post(*key, handler->options.priority, track(discardable([this, handler, id = id, token, params = std::move(params), batch, receivedAt = Clock::now(), trace = TraceContext::current()]() mutable
 			{
-				response = jsonrpc::createErrorResponse(
-					*request.id, MessageError::InvalidParams, e.what());
-			}
-		}
-		catch(const std::exception& e)
-		{
-			if(!request.isNotification())
+				const auto serial     = SerialScope();
+				const auto traceScope = TraceScope(trace);
+				handler->metrics->queueWait.record(Clock::now() - receivedAt);
+
+				if(auto serialResponse = callHandler(*handler, id, token, std::move(params), batch); serialResponse.has_value())
+					finishAsyncRequest(id, std::move(*serialResponse), batch, handler->metrics);
+			},
+			[this, handler, id = id, batch]()
 			{
-				response = jsonrpc::createErrorResponse(
-					*request.id, MessageError::InternalError, e.what());
-			}
+				discardRequest(id, batch, handler->metrics);
+			})));
 		}
-		catch(...)
+		else
 		{
-			t_currentRequestId = nullptr;
-			throw;
-		}
+			response = callHandler(*handler, id, token, std::move(params), batch);
 
-		t_currentRequestId = nullptr;
+			// Requests without a response yet are finished by a worker thread
+			if(response.has_value())
+				endRequest(id);
+		}
 	}
 	else
 	{
@@ -149,23 +296,137 @@ MessageHandler::OptionalResponse MessageHandler::processRequest(jsonrpc::Request
 	return response;
 }
 
+MessageHandler::OptionalResponse MessageHandler::callHandler(const Handler& handler, const MessageId& id, const CancellationToken& token, json::Value&& params, const ResponseBatchPtr& batch)
+{
+	const auto isNotification = std::holds_alternative<std::nullptr_t>(id);
+
+	try
+	{
+		const auto context = RequestContext(id, token);
+		const auto timer   = HandlerTimer(handler.metrics);
+
+		// Serial requests might have been cancelled while they were queued
+		token.throwIfCancelled();
+
+		// Call handler for the method type and return optional response
+		return handler.call(std::move(params), batch);
+	}
+	catch(const RequestError& e)
+	{
+		if(!isNotification)
+			return jsonrpc::createErrorResponse(id, e.code(), e.what(), e.data());
+	}
+	catch(const json::TypeError& e)
+	{
+		if(!isNotification)
+			return jsonrpc::createErrorResponse(id, MessageError::InvalidParams, e.what());
+	}
+	catch(const std::exception& e)
+	{
+		if(!isNotification)
+			return jsonrpc::createErrorResponse(id, MessageError::InternalError, e.what());
+	}
+	catch(...)
+	{
+		if(!isNotification)
+			endRequest(id);
+
+		throw;
+	}
+
+	return std::nullopt;
+}
+
+bool MessageHandler::isRunningSerially()
+{
+	return t_runningSerially;
+}
+
+CancellationToken MessageHandler::beginRequest(const MessageId& id, std::string supersedeKey)
+{
+	auto request = ActiveRequest{CancellationSource(), std::move(supersedeKey)};
+	auto token   = request.cancellation.token();
+
+	std::lock_guard lock{m_activeRequestsMutex};
+
+	if(!request.supersedeKey.empty())
+	{
+		auto& latestId = m_latestRequestIdBySupersedeKey[request.supersedeKey];
+
+		// The result of the older request would be outdated by the time it is computed
+		if(const auto it = m_activeRequests.find(latestId); it != m_activeRequests.end() && it->second.supersedeKey == request.supersedeKey)
+			it->second.cancellation.cancel(MessageError::ContentModified);
+
+		latestId = id;
+	}
+
+	m_activeRequests.insert_or_assign(id, std::move(request));
+
+	return token;
+}
+
+void MessageHandler::endRequest(const MessageId& id)
+{
+	std::lock_guard lock{m_activeRequestsMutex};
+
+	const auto it = m_activeRequests.find(id);
+
+	if(it == m_activeRequests.end())
+		return;
+
+	if(const auto& key = it->second.supersedeKey; !key.empty())
+	{
+		if(const auto latest = m_latestRequestIdBySupersedeKey.find(key); latest != m_latestRequestIdBySupersedeKey.end() && latest->second == id)
+			m_latestRequestIdBySupersedeKey.erase(latest);
+	}
+
+	m_activeRequests.erase(it);
+}
+
+void MessageHandler::cancelRequest(const std::optional<json::Value>& params)
+{
+	if(!params.has_value() || !params->isObject())
+		return;
+
+	const auto* idJson = params->object().find("id");
+	auto        id     = MessageId();
+
+	if(idJson && idJson->isInteger())
+		id = idJson->integer();
+	else if(idJson && idJson->isString())
+		id = idJson->string();
+	else
+		return;
+
+	std::lock_guard lock{m_activeRequestsMutex};
+
+	if(const auto it = m_activeRequests.find(id); it != m_activeRequests.end())
+		it->second.cancellation.cancel();
+}
+
 void MessageHandler::processResponse(jsonrpc::Response&& response)
 {
-	RequestResultPtr result;
+	PendingRequest pending;
 
 	// Find pending request for the response that was received based on the message id.
 	{
 		std::lock_guard lock{m_pendingRequestsMutex};
 		if(auto it = m_pendingRequests.find(response.id); it != m_pendingRequests.end())
 		{
-			result = std::move(it->second);
+			pending = std::move(it->second);
 			m_pendingRequests.erase(it);
 		}
 	}
 
-	if(!result) // If there's no result it means a response was received without a request which makes no sense but just ignore it...
+	// If there's no result it means a response was received without a request or after the request timed out. Just ignore it...
+	if(!pending.result)
 		return;
 
+	if(pending.timeout != TimerWheel::InvalidTimerId)
+		m_threadPool.cancelTimer(pending.timeout);
+
+	auto& result = pending.result;
+
 	try
 	{
 		assert(!t_currentRequestId);
@@ -191,16 +452,44 @@ void MessageHandler::processResponse(jsonrpc::Response&& response)
 	t_currentRequestId = nullptr;
 }
 
-void MessageHandler::addHandler(std::string_view method, HandlerWrapper&& handlerFunc)
+void MessageHandler::addHandler(std::string_view method, const HandlerOptions& options, HandlerWrapper&& handlerFunc)
 {
+	auto handler = std::make_shared<const Handler>(Handler{std::move(handlerFunc), options, &m_connection.metrics().method(method)});
+
 	std::lock_guard lock{m_requestHandlersMutex};
-	m_requestHandlersByMethod[std::string(method)] = std::move(handlerFunc);
+	auto table = std::make_unique<HandlerTable>(*m_requestHandlerTable);
+	table->set(method, std::move(handler));
+	publishHandlerTable(std::move(table));
+}
+
+MessageHandler::HandlerPtr MessageHandler::findHandler(std::string_view method) const
+{
+	// Readers are counted so that writers know when retired tables are no longer in use.
+	// The handler itself is kept alive by the returned pointer.
+	m_requestHandlerReaders.fetch_add(1);
+
+	auto handler = m_requestHandlers.load()->find(method);
+	m_requestHandlerReaders.fetch_sub(1);
+
+	return handler;
 }
 
-MessageHandler& MessageHandler::add(std::string_view method, GenericMessageCallback callback)
+void MessageHandler::publishHandlerTable(std::unique_ptr<const HandlerTable> table)
 {
-	addHandler(method,
-		[f = std::move(callback)](json::Value&& params, bool) -> OptionalResponse
+	// Must be called with m_requestHandlersMutex locked
+	m_requestHandlers.store(table.get());
+	m_retiredRequestHandlerTables.push_back(std::move(m_requestHandlerTable));
+	m_requestHandlerTable = std::move(table);
+
+	// Readers that start after this point can only see the new table
+	if(m_requestHandlerReaders.load() == 0)
+		m_retiredRequestHandlerTables.clear();
+}
+
+MessageHandler& MessageHandler::add(std::string_view method, GenericMessageCallback callback, const HandlerOptions& options)
+{
+	addHandler(method, options,
+		[f = std::move(callback)](json::Value&& params, const ResponseBatchPtr&) -> OptionalResponse
 		{
 			const auto isNotification = std::holds_alternative<std::nullptr_t>(currentRequestId());
 			auto result = f(std::move(params));
@@ -215,32 +504,70 @@ MessageHandler& MessageHandler::add(std::string_view method, GenericMessageCallb
 	return *this;
 }
 
-MessageHandler& MessageHandler::add(std::string_view method, GenericAsyncMessageCallback callback)
+MessageHandler& MessageHandler::add(std::string_view method, GenericAsyncMessageCallback callback, const HandlerOptions& options)
 {
-	addHandler(method,
-		[this, f = std::move(callback)](json::Value&& params, bool allowAsync) -> OptionalResponse
+	addHandler(method, options,
+		[this, f = std::move(callback), options](json::Value&& params, const ResponseBatchPtr& batch) -> OptionalResponse
 		{
 			const auto isNotification = std::holds_alternative<std::nullptr_t>(currentRequestId());
 			auto future = f(std::move(params));
 
-			if(allowAsync)
+			if(isNotification)
 			{
-				m_threadPool.addTask(
-					[this, future = std::move(future), isNotification = isNotification, requestId = currentRequestId()]() mutable
-					{
-						auto response = createResponseFromAsyncResult<GenericMessage>(requestId, future);
-
-						if(!isNotification)
-							sendResponse(std::move(response));
-					}
-				);
-				return std::nullopt;
+				runAsync(options.priority, [timing = HandlerTimer::defer(), future = std::move(future)]() mutable
+				{
+					const auto timer = HandlerTimer(timing);
+					future.get();
+				});
 			}
+			else
+				addAsyncResponseTask<GenericMessage>(currentRequestId(), std::move(future), options, batch);
 
-			auto result = future.get();
+			return std::nullopt;
+		}
+	);
 
-			if(!isNotification)
-				return jsonrpc::createResponse(currentRequestId(), std::move(result));
+	return *this;
+}
+
+std::function<std::optional<std::string>(const json::Value&)> HandlerOptions::paramsKey(std::string path)
+{
+	return [path = std::move(path)](const json::Value& params) -> std::optional<std::string>
+	{
+		const auto* value = &params;
+		auto        rest  = std::string_view(path);
+
+		while(!rest.empty())
+		{
+			const auto dot  = rest.find('.');
+			const auto name = rest.substr(0, dot);
+			rest = dot == std::string_view::npos ? std::string_view() : rest.substr(dot + 1);
+
+			if(!value->isObject())
+				return std::nullopt;
+
+			value = value->object().find(name);
+
+			if(!value)
+				return std::nullopt;
+		}
+
+		if(value->isString())
+			return value->string();
+
+		return json::stringify(*value);
+	};
+}
+
+MessageHandler& MessageHandler::add(std::string_view method, GenericPromiseMessageCallback callback, const HandlerOptions& options)
+{
+	addHandler(method, options,
+		[this, f = std::move(callback)](json::Value&& params, const ResponseBatchPtr& batch) -> OptionalResponse
+		{
+			auto promise = f(std::move(params));
+
+			if(!std::holds_alternative<std::nullptr_t>(currentRequestId()))
+				addPromiseResponse<GenericMessage>(currentRequestId(), std::move(promise), batch);
 
 			return std::nullopt;
 		}
@@ -249,41 +576,258 @@ MessageHandler& MessageHandler::add(std::string_view method, GenericAsyncMessage
 	return *this;
 }
 
-void MessageHandler::sendResponse(jsonrpc::Response&& response)
+MessageHandler& MessageHandler::add(std::string_view method, GenericTaskMessageCallback callback, const HandlerOptions& options)
+{
+	return add(method,
+		GenericPromiseMessageCallback([f = std::move(callback)](json::Value&& params){ return f(std::move(params)).promise(); }),
+		options);
+}
+
+MessageHandler& MessageHandler::addMetricsRequest()
+{
+	return add(MetricsMethod, GenericMessageCallback([this](json::Value&&){ return metricsJson(metrics()); }));
+}
+
+MessageHandler::HandlerPtr MessageHandler::HandlerTable::find(std::string_view method) const
+{
+	if(const auto index = message::methodIndex(method); index < message::MethodCount)
+		return byMethodIndex[index];
+
+	if(const auto it = byCustomMethod.find(method); it != byCustomMethod.end())
+		return it->second;
+
+	return nullptr;
+}
+
+void MessageHandler::HandlerTable::set(std::string_view method, HandlerPtr handler)
+{
+	if(const auto index = message::methodIndex(method); index < message::MethodCount)
+		byMethodIndex[index] = std::move(handler);
+	else if(handler)
+		byCustomMethod[std::string(method)] = std::move(handler);
+	else if(const auto it = byCustomMethod.find(method); it != byCustomMethod.end())
+		byCustomMethod.erase(it);
+}
+
+MessageHandler::RequestContext::RequestContext(const MessageId& id, const CancellationToken& token)
+	: m_previousRequestId{t_currentRequestId}
+	, m_previousCancellationToken{t_currentCancellationToken}
+{
+	t_currentRequestId         = &id;
+	t_currentCancellationToken = &token;
+}
+
+MessageHandler::RequestContext::~RequestContext()
+{
+	t_currentRequestId         = m_previousRequestId;
+	t_currentCancellationToken = m_previousCancellationToken;
+}
+
+thread_local MessageHandler::HandlerTimer* MessageHandler::HandlerTimer::t_current = nullptr;
+
+MessageHandler::HandlerTimer::HandlerTimer(MessageMetrics::Method* metrics)
+	: m_metrics{metrics}
+	, m_recording{metrics != nullptr}
+	, m_elapsed{Clock::duration::zero()}
+	, m_previous{t_current}
 {
-	m_connection.writeMessage(std::move(response));
+	t_current = this;
 }
 
-MessageId MessageHandler::sendRequest(std::string_view method, RequestResultPtr result, std::optional<json::Value>&& params)
+MessageHandler::HandlerTimer::HandlerTimer(const DeferredTiming& deferred)
+	: m_metrics{deferred.metrics}
+	, m_recording{deferred.metrics != nullptr && deferred.recording}
+	, m_elapsed{deferred.elapsed}
+	, m_previous{t_current}
+	, m_traceScope{std::in_place, deferred.trace}
 {
+	if(m_recording)
+		m_metrics->queueWait.record(m_start - deferred.queuedAt);
+
+	t_current = this;
+}
+
+MessageHandler::HandlerTimer::~HandlerTimer()
+{
+	t_current = m_previous;
+	const auto end = Clock::now();
+
+	if(m_recording)
+		m_metrics->handlerTime.record(m_elapsed + (end - m_start));
+
+	if(Tracer::isEnabled())
+		Tracer::record("handler", m_start, end);
+}
+
+MessageHandler::DeferredTiming MessageHandler::HandlerTimer::defer()
+{
+	auto* timer = t_current;
+
+	if(!timer)
+		return {};
+
+	// Serial messages run their asynchronous work right away inside of the timer of the callback
+	if(!timer->m_recording || isRunningSerially())
+		return {.metrics = timer->m_metrics, .trace = TraceContext::current()};
+
+	const auto now = Clock::now();
+	timer->m_recording = false;
+
+	return {
+		.metrics   = timer->m_metrics,
+		.recording = true,
+		.elapsed   = timer->m_elapsed + (now - timer->m_start),
+		.queuedAt  = now,
+		.trace     = TraceContext::current()
+	};
+}
+
+MessageMetrics::Method* MessageHandler::HandlerTimer::currentMetrics()
+{
+	return t_current ? t_current->m_metrics : nullptr;
+}
+
+void MessageHandler::sendResponse(jsonrpc::Response&& response, MessageMetrics::Method* metrics)
+{
+	m_connection.writeMessage(std::move(response), metrics);
+}
+
+void MessageHandler::finishAsyncRequest(const MessageId& id, jsonrpc::Response&& response, const ResponseBatchPtr& batch, MessageMetrics::Method* metrics)
+{
+	endRequest(id);
+
+	if(batch)
+		addBatchResponse(*batch, std::move(response));
+	else
+		sendResponse(std::move(response), metrics);
+}
+
+void MessageHandler::discardRequest(const MessageId& id, const ResponseBatchPtr& batch, MessageMetrics::Method* metrics)
+{
+	// Nobody is waiting for notifications
+	if(std::holds_alternative<std::nullptr_t>(id))
+		return;
+
+	finishAsyncRequest(id, jsonrpc::createErrorResponse(id, MessageError::ServerCancelled, "The request was discarded because the thread pool was stopped"), batch, metrics);
+}
+
+void MessageHandler::addBatchResponse(ResponseBatch& batch, OptionalResponse&& response)
+{
+	auto responses = jsonrpc::MessageBatch();
+
+	{
+		const auto lock = std::lock_guard(batch.mutex);
+
+		if(response.has_value())
+			batch.responses.push_back(std::move(*response));
+
+		assert(batch.pendingCount > 0);
+		if(--batch.pendingCount > 0)
+			return;
+
+		responses = std::move(batch.responses);
+	}
+
+	// Batches that only contained notifications and responses are not answered
+	if(!responses.empty())
+		m_connection.writeMessage(std::move(responses));
+}
+
+MessageId MessageHandler::sendRequest(std::string_view method, RequestResultPtr result, std::optional<json::Value>&& params, const RequestOptions& options)
+{
+	const auto timeout = options.timeout.value_or(m_defaultRequestTimeout.load());
+
 	std::lock_guard lock{m_pendingRequestsMutex};
 	const auto messageId = nextUniqueRequestId();
-	m_pendingRequests[messageId] = std::move(result);
+	auto& pending = m_pendingRequests[messageId];
+	pending.result = std::move(result);
+
+	// The request expires on a worker thread since sending the cancel notification and the error callback can block
+	if(timeout > std::chrono::milliseconds::zero())
+	{
+		// The request still expires if the pool discards the task since the response might never arrive
+		auto expire = [this, messageId](){ expireRequest(messageId); };
+		pending.timeout = m_threadPool.addDelayedTask(timeout, TaskPriority::High, track(discardable(expire, expire)));
+	}
+
 	auto request = jsonrpc::createRequest(messageId, method, std::move(params));
 	m_connection.writeMessage(std::move(request));
 	return messageId;
 }
 
+void MessageHandler::expireRequest(const MessageId& id)
+{
+	RequestResultPtr result;
+
+	{
+		std::lock_guard lock{m_pendingRequestsMutex};
+		if(auto it = m_pendingRequests.find(id); it != m_pendingRequests.end())
+		{
+			result = std::move(it->second.result);
+			m_pendingRequests.erase(it);
+		}
+	}
+
+	// The response arrived in the meantime
+	if(!result)
+		return;
+
+	try
+	{
+		// Let the other side know that nobody is waiting for the result anymore
+		auto params = json::Object();
+		params["id"] = std::visit([](auto v){ return json::Value(std::move(v)); }, id);
+		sendNotification(CancelRequestMethod, std::move(params));
+	}
+	catch(const std::exception&)
+	{
+		// A broken connection is reported to the thread reading messages
+	}
+
+	const auto token   = CancellationToken();
+	const auto context = RequestContext(id, token);
+	result->setError(ResponseError(MessageError::RequestTimedOut, "Request timed out"));
+}
+
+void MessageHandler::waitForTrackedTasks()
+{
+	auto lock = std::unique_lock(m_trackedTasksMutex);
+	m_trackedTasksFinished.wait(lock, [this](){ return m_trackedTaskCount == 0; });
+}
+
+void MessageHandler::setDefaultRequestTimeout(std::chrono::milliseconds timeout)
+{
+	m_defaultRequestTimeout.store(timeout);
+}
+
 MessageId MessageHandler::sendRequest(
 	std::string_view method,
 	std::optional<json::Value>&& params,
 	GenericResponseCallback then,
-	GenericErrorResponseCallback error)
+	GenericErrorResponseCallback error,
+	const RequestOptions& options)
 {
 	auto result = std::make_unique<CallbackRequestResult<json::Value, decltype(then), decltype(error)>>(
 		std::move(then), std::move(error));
-	return sendRequest(method, std::move(result), std::move(params));
+	return sendRequest(method, std::move(result), std::move(params), options);
 }
 
-FutureResponse<MessageHandler::GenericMessage> MessageHandler::sendRequest(std::string_view method, std::optional<json::Value>&& params)
+FutureResponse<MessageHandler::GenericMessage> MessageHandler::sendRequest(std::string_view method, std::optional<json::Value>&& params, const RequestOptions& options)
 {
 	auto result    = std::make_unique<FutureRequestResult<json::Value>>();
 	auto future    = result->future();
-	auto messageId = sendRequest(method, std::move(result), std::move(params));
+	auto messageId = sendRequest(method, std::move(result), std::move(params), options);
 
 	return {std::move(messageId), std::move(future)};
 }
 
+RequestPromise<MessageHandler::GenericMessage> MessageHandler::sendRequestAsync(std::string_view method, std::optional<json::Value>&& params, const RequestOptions& options)
+{
+	auto promise = RequestPromise<GenericMessage>();
+	sendRequest(method, std::make_unique<PromiseRequestResult<json::Value>>(m_threadPool, promise), std::move(params), options);
+	return promise;
+}
+
 void MessageHandler::sendNotification(std::string_view method, std::optional<json::Value>&& params)
 {
 	auto notification = jsonrpc::createNotification(method, std::move(params));
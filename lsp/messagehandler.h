@@ -1,67 +1,141 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <utility>
+#include <vector>
+#include <lsp/cancellation.h>
 #include <lsp/concepts.h>
 #include <lsp/connection.h>
 #include <lsp/error.h>
 #include <lsp/jsonrpc/jsonrpc.h>
 #include <lsp/messagebase.h>
+#include <lsp/methods.h>
+#include <lsp/metrics.h>
 #include <lsp/requestresult.h>
+#include <lsp/serialexecutor.h>
 #include <lsp/serialization.h>
 #include <lsp/strmap.h>
 #include <lsp/threadpool.h>
+#include <lsp/timerwheel.h>
+#include <lsp/tracing.h>
 
 namespace lsp{
 
 using MessageId = jsonrpc::MessageId;
 
+/*
+ * Options for how the callbacks of a message are run
+ */
+struct HandlerOptions{
+	// Priority of asynchronous work in the worker thread pool.
+	// Latency sensitive requests like completion or hover should use a higher priority than
+	// long running ones like workspace/symbol or diagnostics.
+	TaskPriority priority = TaskPriority::Normal;
+
+	// Groups requests that compute the same thing. When a request arrives while an older one with the
+	// same key is still pending, the older one is cancelled and answered with MessageError::ContentModified.
+	// Work that is still queued is skipped so only the newest request is computed.
+	// Returning std::nullopt opts a single request out. Only affects asynchronous requests since
+	// synchronous ones are finished before the next message is read.
+	std::function<std::optional<std::string>(const json::Value& params)> supersedeKey;
+
+	// Messages with the same key are processed one after another on the worker threads in the order they were
+	// received, messages with different keys concurrently. Messages of different methods share the order if they
+	// use the same key, e.g. paramsKey("textDocument.uri") for didChange and completion keeps every document in order.
+	// Futures returned by asynchronous callbacks are evaluated before the next message with the key is processed.
+	// Promise and coroutine callbacks only keep the order until they return. Returning std::nullopt opts a single message out.
+	std::function<std::optional<std::string>(const json::Value& params)> serialKey;
+
+	// Creates a key function that uses the value at a dot separated path in the params as the key, e.g. "textDocument.uri"
+	[[nodiscard]] static std::function<std::optional<std::string>(const json::Value&)> paramsKey(std::string path);
+};
+
+/*
+ * Options for outgoing requests
+ */
+struct RequestOptions{
+	// The request fails with a ResponseError with the RequestTimedOut code if no response was received in time.
+	// Uses the default timeout of the message handler if not set. Zero means the request never times out.
+	std::optional<std::chrono::milliseconds> timeout;
+};
+
 /*
  * MessageHandler
  */
 class MessageHandler{
 public:
 	explicit MessageHandler(Connection& connection, unsigned int maxResponseThreads = std::thread::hardware_concurrency() / 2);
-	~MessageHandler() = default;
+	MessageHandler(Connection& connection, const ThreadPoolOptions& threadPoolOptions);
+	// Runs asynchronous work and timeouts on a pool that can be shared with other handlers.
+	// The pool must outlive the handler.
+	MessageHandler(Connection& connection, ThreadPool& threadPool);
+	~MessageHandler();
 
 	void processIncomingMessages();
+	// Threads that run asynchronous callbacks. Includes the work of other handlers if the pool is shared.
+	[[nodiscard]] ThreadPool::Stats threadPoolStats() const;
+	// True while work the handler posted to its thread pool has not finished, including request timeouts
+	// that have not expired yet. Destroying the handler blocks until the work has finished but drops the timeouts.
+	[[nodiscard]] bool hasPendingTasks() const;
+	// Per method statistics of the connection, see Connection::metrics
+	[[nodiscard]] std::vector<MessageMetrics::MethodSnapshot> metrics() const;
 	// Only valid when called from within a request or response callback.
 	// Throws std::logic_error if not called in that context.
 	[[nodiscard]] static const MessageId& currentRequestId();
+	// Only valid when called from within a request callback or while the future returned by an
+	// asynchronous request callback is evaluated. The token is cancelled once a $/cancelRequest
+	// notification for the current request is received. It is never cancelled for notifications.
+	// Throws std::logic_error if not called in that context.
+	[[nodiscard]] static const CancellationToken& currentCancellationToken();
 
 	struct GenericMessage{
 		using Params = json::Value;
 		using Result = json::Value;
 	};
 
-	using GenericMessageCallback       = std::function<json::Value(json::Value&&)>;
-	using GenericAsyncMessageCallback  = std::function<AsyncRequestResult<GenericMessage>(json::Value&&)>;
-	using GenericResponseCallback      = std::function<void(json::Value&&)>;
-	using GenericErrorResponseCallback = std::function<void(const ResponseError&)>;
+	using GenericMessageCallback        = std::function<json::Value(json::Value&&)>;
+	using GenericAsyncMessageCallback   = std::function<AsyncRequestResult<GenericMessage>(json::Value&&)>;
+	using GenericPromiseMessageCallback = std::function<RequestPromise<GenericMessage>(json::Value&&)>;
+	using GenericTaskMessageCallback    = std::function<RequestTask<GenericMessage>(json::Value&&)>;
+	using GenericResponseCallback       = std::function<void(json::Value&&)>;
+	using GenericErrorResponseCallback  = std::function<void(const ResponseError&)>;
 
 	/*
 	 * Callback registration
 	 */
 
 	template<typename M, typename F>
-	MessageHandler& add(F&& handlerFunc) requires IsRequestCallback<M, F>;
+	MessageHandler& add(F&& handlerFunc, const HandlerOptions& options = {}) requires IsRequestCallback<M, F>;
 
 	template<typename M, typename F>
-	MessageHandler& add(F&& handlerFunc) requires IsNoParamsRequestCallback<M, F>;
+	MessageHandler& add(F&& handlerFunc, const HandlerOptions& options = {}) requires IsNoParamsRequestCallback<M, F>;
 
 	template<typename M, typename F>
-	MessageHandler& add(F&& handlerFunc) requires IsNotificationCallback<M, F>;
+	MessageHandler& add(F&& handlerFunc, const HandlerOptions& options = {}) requires IsNotificationCallback<M, F>;
 
 	template<typename M, typename F>
-	MessageHandler& add(F&& handlerFunc) requires IsNoParamsNotificationCallback<M, F>;
+	MessageHandler& add(F&& handlerFunc, const HandlerOptions& options = {}) requires IsNoParamsNotificationCallback<M, F>;
 
-	MessageHandler& add(std::string_view method, GenericMessageCallback callback);
-	MessageHandler& add(std::string_view method, GenericAsyncMessageCallback callback);
+	MessageHandler& add(std::string_view method, GenericMessageCallback callback, const HandlerOptions& options = {});
+	MessageHandler& add(std::string_view method, GenericAsyncMessageCallback callback, const HandlerOptions& options = {});
+	MessageHandler& add(std::string_view method, GenericPromiseMessageCallback callback, const HandlerOptions& options = {});
+	MessageHandler& add(std::string_view method, GenericTaskMessageCallback callback, const HandlerOptions& options = {});
 
 	void remove(std::string_view method);
 
+	// Answers $/lsp-framework/metrics requests with the metrics of the connection as JSON
+	static constexpr std::string_view MetricsMethod = "$/lsp-framework/metrics";
+	MessageHandler& addMetricsRequest();
+
 	/*
 	 * sendRequest
 	 */
@@ -69,24 +143,43 @@ public:
 	using ResponseErrorCallback = void(*)(const ResponseError&);
 
 	template<typename M, typename F, typename E = ResponseErrorCallback>
-	MessageId sendRequest(typename M::Params&& params, F&& then, E&& error = [](const ResponseError&){}) requires SendRequest<M, F, E>;
+	MessageId sendRequest(typename M::Params&& params, F&& then, E&& error = [](const ResponseError&){}, const RequestOptions& options = {}) requires SendRequest<M, F, E>;
 
 	template<typename M, typename F, typename E = ResponseErrorCallback>
-	MessageId sendRequest(F&& then, E&& error = [](const ResponseError&){}) requires SendNoParamsRequest<M, F, E>;
+	MessageId sendRequest(F&& then, E&& error = [](const ResponseError&){}, const RequestOptions& options = {}) requires SendNoParamsRequest<M, F, E>;
 
 	template<typename M>
-	[[nodiscard]] FutureResponse<M> sendRequest(typename M::Params&& params) requires message::IsRequest<M> && message::HasParams<M>;
+	[[nodiscard]] FutureResponse<M> sendRequest(typename M::Params&& params, const RequestOptions& options = {}) requires message::IsRequest<M> && message::HasParams<M>;
 
 	template<typename M>
-	[[nodiscard]] FutureResponse<M> sendRequest() requires message::IsRequest<M> && (!message::HasParams<M>);
+	[[nodiscard]] FutureResponse<M> sendRequest(const RequestOptions& options = {}) requires message::IsRequest<M> && (!message::HasParams<M>);
 
-	FutureResponse<GenericMessage> sendRequest(std::string_view method, std::optional<json::Value>&& params = std::nullopt);
+	FutureResponse<GenericMessage> sendRequest(std::string_view method, std::optional<json::Value>&& params = std::nullopt, const RequestOptions& options = {});
 
 	MessageId sendRequest(
 		std::string_view method,
 		std::optional<json::Value>&& params,
 		GenericResponseCallback then,
-		GenericErrorResponseCallback error);
+		GenericErrorResponseCallback error,
+		const RequestOptions& options = {});
+
+	// Used for requests that don't specify a timeout. Zero, the default, disables it.
+	// Error callbacks of requests that timed out are called from a separate timer thread.
+	void setDefaultRequestTimeout(std::chrono::milliseconds timeout);
+
+	/*
+	 * sendRequestAsync
+	 * The returned promise is fulfilled on a worker thread once the response was received.
+	 * It can be awaited from a coroutine handler without blocking any thread.
+	 */
+
+	template<typename M>
+	[[nodiscard]] RequestPromise<M> sendRequestAsync(typename M::Params&& params, const RequestOptions& options = {}) requires message::IsRequest<M> && message::HasParams<M>;
+
+	template<typename M>
+	[[nodiscard]] RequestPromise<M> sendRequestAsync(const RequestOptions& options = {}) requires message::IsRequest<M> && (!message::HasParams<M>);
+
+	[[nodiscard]] RequestPromise<GenericMessage> sendRequestAsync(std::string_view method, std::optional<json::Value>&& params = std::nullopt, const RequestOptions& options = {});
 
 	/*
 	 * sendNotification
@@ -106,29 +199,217 @@ private:
 	using RequestResultPtr  = std::unique_ptr<RequestResultBase>;
 	using ResponseResultPtr = std::unique_ptr<ResponseResultBase>;
 	using OptionalResponse  = std::optional<jsonrpc::Response>;
-	using HandlerWrapper    = std::function<OptionalResponse(json::Value&&, bool)>;
+
+	// Collects the responses of a batch until all of its requests have been answered
+	struct ResponseBatch{
+		std::mutex            mutex;
+		jsonrpc::MessageBatch responses;
+		std::size_t           pendingCount = 1; // Held by the thread dispatching the batch
+	};
+
+	using ResponseBatchPtr = std::shared_ptr<ResponseBatch>;
+	using HandlerWrapper   = std::function<OptionalResponse(json::Value&&, const ResponseBatchPtr&)>;
+
+	struct Handler{
+		HandlerWrapper          call;
+		HandlerOptions          options;
+		MessageMetrics::Method* metrics;
+	};
+
+	using HandlerPtr = std::shared_ptr<const Handler>;
+
+	struct PendingRequest{
+		RequestResultPtr    result;
+		ThreadPool::TimerId timeout = TimerWheel::InvalidTimerId;
+	};
+
+	struct ActiveRequest{
+		CancellationSource cancellation;
+		std::string        supersedeKey;
+	};
+
+	// Handlers for methods defined by the protocol are found with the generated message::methodIndex
+	// instead of hashing the method. The map is only used for custom methods.
+	struct HandlerTable{
+		std::array<HandlerPtr, message::MethodCount> byMethodIndex;
+		StrMap<std::string, HandlerPtr>              byCustomMethod;
+
+		[[nodiscard]] HandlerPtr find(std::string_view method) const;
+		void set(std::string_view method, HandlerPtr handler);
+	};
 
 	// General
-	Connection&                                      m_connection;
-	ThreadPool                                       m_threadPool;
+	Connection&                                       m_connection;
+	std::unique_ptr<ThreadPool>                       m_ownedThreadPool; // Null if the pool is shared
+	ThreadPool&                                       m_threadPool;
+	SerialExecutor                                    m_serialExecutor;
 	// Incoming requests
-	StrMap<std::string, HandlerWrapper>              m_requestHandlersByMethod;
-	std::mutex                                       m_requestHandlersMutex;
+	// The handler table is immutable once published. add/remove publish a modified copy
+	// so looking up a handler never has to take a lock.
+	std::atomic<const HandlerTable*>                  m_requestHandlers;
+	mutable std::atomic<unsigned int>                 m_requestHandlerReaders = 0;
+	std::mutex                                        m_requestHandlersMutex; // Only taken by writers
+	std::unique_ptr<const HandlerTable>               m_requestHandlerTable;
+	std::vector<std::unique_ptr<const HandlerTable>>  m_retiredRequestHandlerTables;
+	// Requests that are still being processed and the newest request for each supersede key
+	std::mutex                                        m_activeRequestsMutex;
+	std::unordered_map<MessageId, ActiveRequest>      m_activeRequests;
+	StrMap<std::string, MessageId>                    m_latestRequestIdBySupersedeKey;
 	// Outgoing requests
-	std::mutex                                       m_pendingRequestsMutex;
-	std::unordered_map<MessageId, RequestResultPtr>  m_pendingRequests;
+	std::mutex                                        m_pendingRequestsMutex;
+	std::unordered_map<MessageId, PendingRequest>     m_pendingRequests;
+	std::atomic<std::chrono::milliseconds>            m_defaultRequestTimeout = std::chrono::milliseconds::zero();
+	// Tasks that use the handler and have not run or been destroyed yet
+	mutable std::mutex                                m_trackedTasksMutex;
+	std::condition_variable                           m_trackedTasksFinished;
+	std::size_t                                       m_trackedTaskCount = 0;
+	// Promises are not tracked since they may never be fulfilled. Their callbacks check this under a shared lock
+	// and do nothing once the handler is being destroyed.
+	struct Liveness{
+		std::shared_mutex mutex;
+		bool              alive = true;
+	};
+	std::shared_ptr<Liveness>                         m_liveness = std::make_shared<Liveness>();
+
+	// toJson and fromJson with a trace span
+	template<typename T>
+	static json::Value traceToJson(T&& value);
+
+	template<typename T>
+	static void traceFromJson(json::Value&& json, T& value);
 
 	template<typename T>
 	static jsonrpc::Response createResponse(const MessageId& id, T&& result);
 
+	template<typename F>
+	static jsonrpc::Response createResponseFromAsyncResult(const MessageId& id, F&& getResult, const CancellationToken& token);
+
+	template<typename M>
+	void addAsyncResponseTask(const MessageId& id, AsyncRequestResult<M>&& result, const HandlerOptions& options, const ResponseBatchPtr& batch);
+
 	template<typename M>
-	static jsonrpc::Response createResponseFromAsyncResult(const MessageId& id, AsyncRequestResult<M>& result);
+	void addPromiseResponse(const MessageId& id, RequestPromise<M>&& promise, const ResponseBatchPtr& batch);
 
-	OptionalResponse processRequest(jsonrpc::Request&& request, bool allowAsync);
+	template<typename F>
+	void runAsync(TaskPriority priority, F&& f);
+
+	// onDiscard is called instead of f if ThreadPool::stop discards the task
+	template<typename F, typename D>
+	void runAsync(TaskPriority priority, F&& f, D&& onDiscard);
+
+	OptionalResponse processRequest(jsonrpc::Request&& request, const ResponseBatchPtr& batch);
+	OptionalResponse callHandler(const Handler& handler, const MessageId& id, const CancellationToken& token, json::Value&& params, const ResponseBatchPtr& batch);
+	[[nodiscard]] static bool isRunningSerially();
+	CancellationToken beginRequest(const MessageId& id, std::string supersedeKey);
+	void endRequest(const MessageId& id);
+	void cancelRequest(const std::optional<json::Value>& params);
 	void processResponse(jsonrpc::Response&& response);
-	void addHandler(std::string_view method, HandlerWrapper&& handlerFunc);
-	void sendResponse(jsonrpc::Response&& response);
-	MessageId sendRequest(std::string_view method, RequestResultPtr result, std::optional<json::Value>&& params = std::nullopt);
+	void addHandler(std::string_view method, const HandlerOptions& options, HandlerWrapper&& handlerFunc);
+	[[nodiscard]] HandlerPtr findHandler(std::string_view method) const;
+	void publishHandlerTable(std::unique_ptr<const HandlerTable> table);
+	void sendResponse(jsonrpc::Response&& response, MessageMetrics::Method* metrics);
+	void addBatchResponse(ResponseBatch& batch, OptionalResponse&& response);
+	void finishAsyncRequest(const MessageId& id, jsonrpc::Response&& response, const ResponseBatchPtr& batch, MessageMetrics::Method* metrics);
+	MessageId sendRequest(std::string_view method, RequestResultPtr result, std::optional<json::Value>&& params, const RequestOptions& options);
+	void expireRequest(const MessageId& id);
+	// Answers a request whose task was discarded by ThreadPool::stop before it could run
+	void discardRequest(const MessageId& id, const ResponseBatchPtr& batch, MessageMetrics::Method* metrics);
+	void waitForTrackedTasks();
+
+	/*
+	 * Wraps work that is posted to the thread pool or scheduled as a delayed task.
+	 * The handler is not destroyed before every tracked task has either run or been destroyed.
+	 */
+	template<typename F>
+	class TrackedTask{
+	public:
+		TrackedTask(MessageHandler& handler, F&& callback);
+		TrackedTask(TrackedTask&& other) noexcept;
+		TrackedTask& operator=(TrackedTask&&) = delete;
+		~TrackedTask();
+
+		void operator()(){ std::invoke(m_callback); }
+		void discard() requires requires(F& f){ f.discard(); }{ m_callback.discard(); }
+
+	private:
+		MessageHandler* m_handler;
+		F               m_callback;
+	};
+
+	template<typename F>
+	TrackedTask<std::decay_t<F>> track(F&& f);
+
+	/*
+	 * Work that has to be finished differently if ThreadPool::stop discards it, e.g. by answering its request
+	 */
+	template<typename F, typename D>
+	struct DiscardableTask{
+		F run;
+		D onDiscard;
+
+		void operator()(){ std::invoke(run); }
+		void discard(){ std::invoke(onDiscard); }
+	};
+
+	template<typename F, typename D>
+	static DiscardableTask<std::decay_t<F>, std::decay_t<D>> discardable(F&& f, D&& onDiscard);
+
+	/*
+	 * Makes the id and cancellation token of a request available through
+	 * currentRequestId and currentCancellationToken for the lifetime of the context.
+	 * Contexts can be nested since a promise can be fulfilled from within another request.
+	 */
+
+	class RequestContext{
+	public:
+		RequestContext(const MessageId& id, const CancellationToken& token);
+		RequestContext(const RequestContext&) = delete;
+		RequestContext& operator=(const RequestContext&) = delete;
+		~RequestContext();
+
+	private:
+		const MessageId*         m_previousRequestId;
+		const CancellationToken* m_previousCancellationToken;
+	};
+
+	/*
+	 * Measures the handler time of a callback for the metrics of its method.
+	 * When the work of a callback continues on a worker thread, defer stops the timer of the callback and the
+	 * worker continues timing it with a timer created from the returned DeferredTiming.
+	 * Each timer also records a handler span, tagged with the trace scope of the callback when it was deferred.
+	 */
+
+	using Clock = std::chrono::steady_clock;
+
+	struct DeferredTiming{
+		MessageMetrics::Method* metrics   = nullptr;
+		bool                    recording = false; // False if the work runs inside of the timer of the callback
+		Clock::duration         elapsed   = Clock::duration::zero();
+		Clock::time_point       queuedAt  = {};
+		TraceContext            trace     = {};
+	};
+
+	class HandlerTimer{
+	public:
+		explicit HandlerTimer(MessageMetrics::Method* metrics);
+		explicit HandlerTimer(const DeferredTiming& deferred);
+		HandlerTimer(const HandlerTimer&) = delete;
+		HandlerTimer& operator=(const HandlerTimer&) = delete;
+		~HandlerTimer();
+
+		[[nodiscard]] static DeferredTiming defer();
+		[[nodiscard]] static MessageMetrics::Method* currentMetrics();
+
+	private:
+		static thread_local HandlerTimer* t_current;
+
+		MessageMetrics::Method*   m_metrics;
+		bool                      m_recording;
+		Clock::duration           m_elapsed;
+		Clock::time_point         m_start = Clock::now();
+		HandlerTimer*             m_previous;
+		std::optional<TraceScope> m_traceScope; // Only used by deferred timers
+	};
 
 	/*
 	 * Request result wrapper
@@ -169,6 +450,26 @@ private:
 	private:
 		std::promise<T> m_promise;
 	};
+
+	template<typename T>
+	class PromiseRequestResult final : public RequestResultBase{
+	public:
+		PromiseRequestResult(ThreadPool& threadPool, Promise<T> promise)
+			: m_threadPool{threadPool}
+			, m_promise{std::move(promise)}
+		{
+		}
+
+		void setValueFromJson(json::Value&& json) override;
+		void setError(ResponseError&& error) override;
+
+	private:
+		ThreadPool& m_threadPool;
+		Promise<T>  m_promise;
+
+		void setException(std::exception_ptr error);
+		[[nodiscard]] auto discardedPromise() const;
+	};
 };
 
 } // namespace lsp
@@ -8,18 +8,37 @@ namespace lsp{
  * createResponse
  */
 
+template<typename T>
+json::Value MessageHandler::traceToJson(T&& value)
+{
+	const auto span = TraceSpan("toJson");
+	return toJson(std::forward<T>(value));
+}
+
+template<typename T>
+void MessageHandler::traceFromJson(json::Value&& json, T& value)
+{
+	const auto span = TraceSpan("fromJson");
+	fromJson(std::move(json), value);
+}
+
 template<typename T>
 jsonrpc::Response MessageHandler::createResponse(const MessageId& id, T&& result)
 {
-	return jsonrpc::createResponse(id, toJson(std::forward<T>(result)));
+	return jsonrpc::createResponse(id, traceToJson(std::forward<T>(result)));
 }
 
-template<typename M>
-jsonrpc::Response MessageHandler::createResponseFromAsyncResult(const MessageId& id, AsyncRequestResult<M>& result)
+template<typename F>
+jsonrpc::Response MessageHandler::createResponseFromAsyncResult(const MessageId& id, F&& getResult, const CancellationToken& token)
 {
 	try
 	{
-		return createResponse(id, result.get());
+		// Deferred work of a request that was cancelled while it was queued is never run
+		token.throwIfCancelled();
+		auto value = getResult();
+		// Don't serialize a result nobody is waiting for anymore
+		token.throwIfCancelled();
+		return createResponse(id, std::move(value));
 	}
 	catch(const RequestError& e)
 	{
@@ -31,41 +50,102 @@ jsonrpc::Response MessageHandler::createResponseFromAsyncResult(const MessageId&
 	}
 }
 
+template<typename F>
+void MessageHandler::runAsync(TaskPriority priority, F&& f)
+{
+	// Serial messages finish their asynchronous work before the next one with the same key is processed
+	if(isRunningSerially())
+		f();
+	else
+		m_threadPool.post(priority, track(std::forward<F>(f)));
+}
+
+template<typename F, typename D>
+void MessageHandler::runAsync(TaskPriority priority, F&& f, D&& onDiscard)
+{
+	if(isRunningSerially())
+		f();
+	else
+		m_threadPool.post(priority, track(discardable(std::forward<F>(f), std::forward<D>(onDiscard))));
+}
+
+template<typename M>
+void MessageHandler::addAsyncResponseTask(const MessageId& id, AsyncRequestResult<M>&& result, const HandlerOptions& options, const ResponseBatchPtr& batch)
+{
+	runAsync(options.priority, [this, id = id, token = currentCancellationToken(), timing = HandlerTimer::defer(), result = std::move(result), batch]() mutable
+	{
+		const auto traceScope = TraceScope(timing.trace);
+		auto response = [&]()
+		{
+			const auto context = RequestContext(id, token);
+			const auto timer   = HandlerTimer(timing);
+			return createResponseFromAsyncResult(id, [&result]{ return result.get(); }, token);
+		}();
+
+		finishAsyncRequest(id, std::move(response), batch, timing.metrics);
+	},
+	[this, id = id, batch, metrics = HandlerTimer::currentMetrics()]()
+	{
+		discardRequest(id, batch, metrics);
+	});
+}
+
+template<typename M>
+void MessageHandler::addPromiseResponse(const MessageId& id, RequestPromise<M>&& promise, const ResponseBatchPtr& batch)
+{
+	// Runs on the thread that fulfills the promise, which can happen after the handler was destroyed
+	promise.onReady([this, liveness = m_liveness, id = id, token = currentCancellationToken(), metrics = HandlerTimer::currentMetrics(), trace = TraceContext::current(), batch](typename RequestPromise<M>::Result&& result)
+	{
+		const auto lock = std::shared_lock(liveness->mutex);
+
+		if(!liveness->alive)
+			return;
+
+		const auto traceScope = TraceScope(trace);
+		auto response = [&]()
+		{
+			const auto context = RequestContext(id, token);
+			return createResponseFromAsyncResult(id, [&result]{ return std::move(result).get(); }, token);
+		}();
+
+		finishAsyncRequest(id, std::move(response), batch, metrics);
+	});
+}
+
 /*
  * add
  */
 
 template<typename M, typename F>
-MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsRequestCallback<M, F>
+MessageHandler& MessageHandler::add(F&& handlerFunc, const HandlerOptions& options) requires IsRequestCallback<M, F>
 {
-	addHandler(M::Method,
-	[this, f = std::forward<F>(handlerFunc)](json::Value&& json, bool allowAsync) -> OptionalResponse
+	addHandler(M::Method, options,
+	[this, f = std::forward<F>(handlerFunc), options](json::Value&& json, const ResponseBatchPtr& batch) -> OptionalResponse
 	{
 		typename M::Params params;
-		fromJson(std::move(json), params);
+		traceFromJson(std::move(json), params);
 		const auto& id = currentRequestId();
 
 		if constexpr(IsCallbackResult<AsyncRequestResult<M>, typename M::Params, F>)
 		{
-			auto future = f(std::move(params));
-
-			if(allowAsync)
-			{
-				m_threadPool.addTask([this, id = id, future = std::move(future)]() mutable
-				{
-					auto response = createResponseFromAsyncResult<M>(id, future);
-					sendResponse(std::move(response));
-				});
-
-				return std::nullopt;
-			}
-
-			return createResponse(id, future.get());
+			addAsyncResponseTask<M>(id, f(std::move(params)), options, batch);
+			return std::nullopt;
+		}
+		else if constexpr(IsCallbackResult<RequestPromise<M>, typename M::Params, F>)
+		{
+			addPromiseResponse<M>(id, f(std::move(params)), batch);
+			return std::nullopt;
+		}
+		else if constexpr(IsCallbackResult<RequestTask<M>, typename M::Params, F>)
+		{
+			addPromiseResponse<M>(id, f(std::move(params)).promise(), batch);
+			return std::nullopt;
 		}
 		else
 		{
 			(void)this;
-			(void)allowAsync;
+			(void)batch;
+			(void)options;
 			return createResponse(id, f(std::move(params)));
 		}
 	});
@@ -74,34 +154,33 @@ MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsRequestCallback<
 }
 
 template<typename M, typename F>
-MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNoParamsRequestCallback<M, F>
+MessageHandler& MessageHandler::add(F&& handlerFunc, const HandlerOptions& options) requires IsNoParamsRequestCallback<M, F>
 {
-	addHandler(M::Method,
-	[this, f = std::forward<F>(handlerFunc)](json::Value&&, bool allowAsync) -> OptionalResponse
+	addHandler(M::Method, options,
+	[this, f = std::forward<F>(handlerFunc), options](json::Value&&, const ResponseBatchPtr& batch) -> OptionalResponse
 	{
 		const auto& id = currentRequestId();
 
 		if constexpr(IsNoParamsCallbackResult<AsyncRequestResult<M>, F>)
 		{
-			auto future = f();
-
-			if(allowAsync)
-			{
-				m_threadPool.addTask([this, id = id, result = std::move(future)]() mutable
-				{
-					auto response = createResponseFromAsyncResult<M>(id, result);
-					sendResponse(std::move(response));
-				});
-
-				return std::nullopt;
-			}
-
-			return createResponse(id, future.get());
+			addAsyncResponseTask<M>(id, f(), options, batch);
+			return std::nullopt;
+		}
+		else if constexpr(IsNoParamsCallbackResult<RequestPromise<M>, F>)
+		{
+			addPromiseResponse<M>(id, f(), batch);
+			return std::nullopt;
+		}
+		else if constexpr(IsNoParamsCallbackResult<RequestTask<M>, F>)
+		{
+			addPromiseResponse<M>(id, f().promise(), batch);
+			return std::nullopt;
 		}
 		else
 		{
 			(void)this;
-			(void)allowAsync;
+			(void)batch;
+			(void)options;
 			return createResponse(id, f());
 		}
 	});
@@ -110,34 +189,34 @@ MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNoParamsRequestC
 }
 
 template<typename M, typename F>
-MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNotificationCallback<M, F>
+MessageHandler& MessageHandler::add(F&& handlerFunc, const HandlerOptions& options) requires IsNotificationCallback<M, F>
 {
-	addHandler(M::Method,
-	[this, f = std::forward<F>(handlerFunc)](json::Value&& json, bool allowAsync) -> OptionalResponse
+	addHandler(M::Method, options,
+	[this, f = std::forward<F>(handlerFunc), options](json::Value&& json, const ResponseBatchPtr&) -> OptionalResponse
 	{
 		typename M::Params params;
-		fromJson(std::move(json), params);
+		traceFromJson(std::move(json), params);
 
 		if constexpr(IsCallbackResult<AsyncNotificationResult, typename M::Params, F>)
 		{
-			auto future = f(std::move(params));
+			auto result = f(std::move(params));
 
-			if(allowAsync)
-			{
-				m_threadPool.addTask([result = std::move(future)]() mutable
-				{
-					result.get();
-				});
-			}
-			else
+			runAsync(options.priority, [timing = HandlerTimer::defer(), result = std::move(result)]() mutable
 			{
-				future.get();
-			}
+				const auto timer = HandlerTimer(timing);
+				result.get();
+			});
+		}
+		else if constexpr(IsCallbackResult<NotificationPromise, typename M::Params, F> ||
+		                  IsCallbackResult<NotificationTask, typename M::Params, F>)
+		{
+			// Nobody is waiting for the outcome of a notification
+			(void)f(std::move(params));
 		}
 		else
 		{
 			(void)this;
-			(void)allowAsync;
+			(void)options;
 			f(std::move(params));
 		}
 
@@ -148,31 +227,31 @@ MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNotificationCall
 }
 
 template<typename M, typename F>
-MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNoParamsNotificationCallback<M, F>
+MessageHandler& MessageHandler::add(F&& handlerFunc, const HandlerOptions& options) requires IsNoParamsNotificationCallback<M, F>
 {
-	addHandler(M::Method,
-	[this, f = std::forward<F>(handlerFunc)](json::Value&&, bool allowAsync) -> OptionalResponse
+	addHandler(M::Method, options,
+	[this, f = std::forward<F>(handlerFunc), options](json::Value&&, const ResponseBatchPtr&) -> OptionalResponse
 	{
 		if constexpr(IsNoParamsCallbackResult<AsyncNotificationResult, F>)
 		{
-			auto future = f();
+			auto result = f();
 
-			if(allowAsync)
-			{
-				m_threadPool.addTask([result = std::move(future)]() mutable
-				{
-					result.get();
-				});
-			}
-			else
+			runAsync(options.priority, [timing = HandlerTimer::defer(), result = std::move(result)]() mutable
 			{
-				future.get();
-			}
+				const auto timer = HandlerTimer(timing);
+				result.get();
+			});
+		}
+		else if constexpr(IsNoParamsCallbackResult<NotificationPromise, F> ||
+		                  IsNoParamsCallbackResult<NotificationTask, F>)
+		{
+			// Nobody is waiting for the outcome of a notification
+			(void)f();
 		}
 		else
 		{
 			(void)this;
-			(void)allowAsync;
+			(void)options;
 			f();
 		}
 
@@ -182,42 +261,107 @@ MessageHandler& MessageHandler::add(F&& handlerFunc) requires IsNoParamsNotifica
 	return *this;
 }
 
+/*
+ * TrackedTask
+ */
+
+template<typename F>
+MessageHandler::TrackedTask<F>::TrackedTask(MessageHandler& handler, F&& callback)
+	: m_handler{&handler}
+	, m_callback{std::move(callback)}
+{
+	const auto lock = std::lock_guard(handler.m_trackedTasksMutex);
+	++handler.m_trackedTaskCount;
+}
+
+template<typename F>
+MessageHandler::TrackedTask<F>::TrackedTask(TrackedTask&& other) noexcept
+	: m_handler{std::exchange(other.m_handler, nullptr)}
+	, m_callback{std::move(other.m_callback)}
+{
+}
+
+template<typename F>
+MessageHandler::TrackedTask<F>::~TrackedTask()
+{
+	if(!m_handler)
+		return;
+
+	// Notified with the lock held since the handler can be destroyed as soon as the count reaches zero
+	const auto lock = std::lock_guard(m_handler->m_trackedTasksMutex);
+
+	if(--m_handler->m_trackedTaskCount == 0)
+		m_handler->m_trackedTasksFinished.notify_all();
+}
+
+template<typename F>
+MessageHandler::TrackedTask<std::decay_t<F>> MessageHandler::track(F&& f)
+{
+	return TrackedTask<std::decay_t<F>>(*this, std::decay_t<F>(std::forward<F>(f)));
+}
+
+template<typename F, typename D>
+MessageHandler::DiscardableTask<std::decay_t<F>, std::decay_t<D>> MessageHandler::discardable(F&& f, D&& onDiscard)
+{
+	return {std::forward<F>(f), std::forward<D>(onDiscard)};
+}
+
 /*
  * sendRequest
  */
 
 template<typename M, typename F, typename E>
-MessageId MessageHandler::sendRequest(typename M::Params&& params, F&& then, E&& error) requires SendRequest<M, F, E>
+MessageId MessageHandler::sendRequest(typename M::Params&& params, F&& then, E&& error, const RequestOptions& options) requires SendRequest<M, F, E>
 {
 	auto result = std::make_unique<CallbackRequestResult<typename M::Result, F, E>>(std::forward<F>(then), std::forward<E>(error));
-	return sendRequest(M::Method, std::move(result), toJson(std::move(params)));
+	return sendRequest(M::Method, std::move(result), traceToJson(std::move(params)), options);
 }
 
 template<typename M, typename F, typename E>
-MessageId MessageHandler::sendRequest(F&& then, E&& error) requires SendNoParamsRequest<M, F, E>
+MessageId MessageHandler::sendRequest(F&& then, E&& error, const RequestOptions& options) requires SendNoParamsRequest<M, F, E>
 {
 	auto result = std::make_unique<CallbackRequestResult<typename M::Result, F, E>>(std::forward<F>(then), std::forward<E>(error));
-	return sendRequest(M::Method, std::move(result));
+	return sendRequest(M::Method, std::move(result), std::nullopt, options);
 }
 
 template<typename M>
-FutureResponse<M> MessageHandler::sendRequest(typename M::Params&& params) requires message::IsRequest<M> && message::HasParams<M>
+FutureResponse<M> MessageHandler::sendRequest(typename M::Params&& params, const RequestOptions& options) requires message::IsRequest<M> && message::HasParams<M>
 {
 	auto result    = std::make_unique<FutureRequestResult<typename M::Result>>();
 	auto future    = result->future();
-	auto messageId = sendRequest(M::Method, std::move(result), toJson(std::move(params)));
+	auto messageId = sendRequest(M::Method, std::move(result), traceToJson(std::move(params)), options);
 	return {std::move(messageId), std::move(future)};
 }
 
 template<typename M>
-FutureResponse<M> MessageHandler::sendRequest() requires message::IsRequest<M> && (!message::HasParams<M>)
+FutureResponse<M> MessageHandler::sendRequest(const RequestOptions& options) requires message::IsRequest<M> && (!message::HasParams<M>)
 {
 	auto result    = std::make_unique<FutureRequestResult<typename M::Result>>();
 	auto future    = result->future();
-	auto messageId = sendRequest(M::Method, std::move(result));
+	auto messageId = sendRequest(M::Method, std::move(result), std::nullopt, options);
 	return {std::move(messageId), std::move(future)};
 }
 
+/*
+ * sendRequestAsync
+ */
+
+template<typename M>
+RequestPromise<M> MessageHandler::sendRequestAsync(typename M::Params&& params, const RequestOptions& options) requires message::IsRequest<M> && message::HasParams<M>
+{
+	auto promise = RequestPromise<M>();
+	sendRequest(M::Method, std::make_unique<PromiseRequestResult<typename M::Result>>(m_threadPool, promise), traceToJson(std::move(params)), options);
+	return promise;
+}
+
+template<typename M>
+RequestPromise<M> MessageHandler::sendRequestAsync(const RequestOptions& options) requires message::IsRequest<M> && (!message::HasParams<M>)
+{
+	auto promise = RequestPromise<M>();
+	sendRequest(M::Method, std::make_unique<PromiseRequestResult<typename M::Result>>(m_threadPool, promise), std::nullopt, options);
+	return promise;
+}
+
 /*
  * sendNotification
  */
@@ -225,7 +369,7 @@ FutureResponse<M> MessageHandler::sendRequest() requires message::IsRequest<M> &
 template<typename M>
 void MessageHandler::sendNotification(typename M::Params&& params) requires SendNotification<M>
 {
-	sendNotification(M::Method, toJson(std::move(params)));
+	sendNotification(M::Method, traceToJson(std::move(params)));
 }
 
 template<typename M>
@@ -244,7 +388,7 @@ void MessageHandler::FutureRequestResult<T>::setValueFromJson(json::Value&& json
 	try
 	{
 		auto value = T();
-		fromJson(std::move(json), value);
+		traceFromJson(std::move(json), value);
 		m_promise.set_value(std::move(value));
 	}
 	catch(const Exception& e)
@@ -259,6 +403,56 @@ void MessageHandler::FutureRequestResult<T>::setError(ResponseError&& error)
 	m_promise.set_exception(std::make_exception_ptr(std::move(error)));
 }
 
+/*
+ * PromiseRequestResult
+ */
+
+// The promise is fulfilled on a worker thread so that continuations don't run on the message thread.
+// Continuations finish work that has already been started which is why they get a high priority.
+
+// Fails the promise if the task that fulfills it is discarded so a coroutine that awaits it still finishes
+template<typename T>
+auto MessageHandler::PromiseRequestResult<T>::discardedPromise() const
+{
+	return [promise = m_promise]() mutable
+	{
+		promise.setException(std::make_exception_ptr(RequestError(MessageError::ServerCancelled, "The response was discarded because the thread pool was stopped")));
+	};
+}
+
+template<typename T>
+void MessageHandler::PromiseRequestResult<T>::setValueFromJson(json::Value&& json)
+{
+	try
+	{
+		auto value = T();
+		traceFromJson(std::move(json), value);
+		m_threadPool.post(TaskPriority::High, discardable([promise = m_promise, value = std::move(value)]() mutable
+		{
+			promise.setValue(std::move(value));
+		}, discardedPromise()));
+	}
+	catch(const Exception& e)
+	{
+		setException(std::make_exception_ptr(e));
+	}
+}
+
+template<typename T>
+void MessageHandler::PromiseRequestResult<T>::setError(ResponseError&& error)
+{
+	setException(std::make_exception_ptr(std::move(error)));
+}
+
+template<typename T>
+void MessageHandler::PromiseRequestResult<T>::setException(std::exception_ptr error)
+{
+	m_threadPool.post(TaskPriority::High, discardable([promise = m_promise, error = std::move(error)]() mutable
+	{
+		promise.setException(std::move(error));
+	}, discardedPromise()));
+}
+
 /*
  * CallbackRequestResult
  */
@@ -269,7 +463,7 @@ void MessageHandler::CallbackRequestResult<T, F, E>::setValueFromJson(json::Valu
 	try
 	{
 		auto value = T();
-		fromJson(std::move(json), value);
+		traceFromJson(std::move(json), value);
 		m_then(std::move(value));
 	}
 	catch(const json::Error& error)
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <lsp/methods.h>
+#include <lsp/metrics.h>
+
+namespace lsp{
+
+/*
+ * Histogram
+ */
+
+double Histogram::Snapshot::mean() const
+{
+	return count > 0 ? static_cast<double>(sum) / static_cast<double>(count) : 0.0;
+}
+
+std::uint64_t Histogram::Snapshot::percentile(double percent) const
+{
+	if(count == 0)
+		return 0;
+
+	const auto rank = std::max(static_cast<std::uint64_t>(std::ceil(std::clamp(percent, 0.0, 100.0) / 100.0 * static_cast<double>(count))), std::uint64_t(1));
+	auto       seen = std::uint64_t(0);
+
+	for(std::size_t i = 0; i < buckets.size(); ++i)
+	{
+		seen += buckets[i];
+
+		if(seen >= rank)
+			return std::min(bucketUpperBound(i), max);
+	}
+
+	return max;
+}
+
+void Histogram::record(std::uint64_t value)
+{
+	m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+
+	auto max = m_max.load(std::memory_order_relaxed);
+
+	while(value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)){}
+}
+
+void Histogram::record(std::chrono::steady_clock::duration duration)
+{
+	const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	record(static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(nanoseconds, 0)));
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+	auto result = Snapshot();
+	result.sum = m_sum.load(std::memory_order_relaxed);
+	result.max = m_max.load(std::memory_order_relaxed);
+	result.buckets.resize(BucketCount);
+
+	// The count is derived from the buckets so that percentiles stay consistent with it
+	for(std::size_t i = 0; i < BucketCount; ++i)
+	{
+		result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+		result.count += result.buckets[i];
+	}
+
+	while(!result.buckets.empty() && result.buckets.back() == 0)
+		result.buckets.pop_back();
+
+	return result;
+}
+
+std::size_t Histogram::bucketIndex(std::uint64_t value)
+{
+	// Values below SubBucketCount get a bucket each. Above that, the highest bit selects the range
+	// and the SubBucketBits below it the bucket within the range.
+	if(value < SubBucketCount)
+		return static_cast<std::size_t>(value);
+
+	const auto exponent = static_cast<unsigned int>(std::bit_width(value)) - 1;
+	const auto range    = exponent - SubBucketBits + 1;
+	const auto subIndex = (value >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+
+	return range * SubBucketCount + static_cast<std::size_t>(subIndex);
+}
+
+std::uint64_t Histogram::bucketUpperBound(std::size_t index)
+{
+	if(index < SubBucketCount)
+		return index;
+
+	const auto shift = index / SubBucketCount - 1;
+	const auto lower = (SubBucketCount + index % SubBucketCount) << shift;
+
+	return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+/*
+ * MessageMetrics
+ */
+
+MessageMetrics::MessageMetrics()
+	: m_protocolMethods{std::make_unique<std::atomic<Method*>[]>(message::MethodCount)}
+{
+}
+
+MessageMetrics::~MessageMetrics()
+{
+	for(std::size_t i = 0; i < message::MethodCount; ++i)
+		delete m_protocolMethods[i].load();
+}
+
+MessageMetrics::Method& MessageMetrics::method(std::string_view name)
+{
+	if(const auto index = message::methodIndex(name); index < message::MethodCount)
+	{
+		auto& entry    = m_protocolMethods[index];
+		auto* existing = entry.load(std::memory_order_acquire);
+
+		if(existing)
+			return *existing;
+
+		// Another thread might create the entry at the same time
+		auto created = std::make_unique<Method>();
+
+		if(entry.compare_exchange_strong(existing, created.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+			return *created.release();
+
+		return *existing;
+	}
+
+	const auto lock = std::lock_guard(m_customMethodsMutex);
+
+	if(const auto it = m_customMethods.find(name); it != m_customMethods.end())
+		return *it->second;
+
+	// Don't let messages with made up methods grow the map without limit
+	const auto key = m_customMethods.size() < MaxCustomMethods ? name : OtherMethods;
+	auto       it  = m_customMethods.find(key);
+
+	if(it == m_customMethods.end())
+		it = m_customMethods.emplace(std::string(key), std::make_unique<Method>()).first;
+
+	return *it->second;
+}
+
+std::vector<MessageMetrics::MethodSnapshot> MessageMetrics::snapshot() const
+{
+	auto result      = std::vector<MethodSnapshot>();
+	auto addSnapshot = [&result](std::string_view name, const Method& method)
+	{
+		const auto receivedCount = method.receivedCount.load(std::memory_order_relaxed);
+		const auto sentCount     = method.sentCount.load(std::memory_order_relaxed);
+
+		if(receivedCount == 0 && sentCount == 0)
+			return;
+
+		result.push_back({
+			.method            = std::string(name),
+			.receivedCount     = receivedCount,
+			.sentCount         = sentCount,
+			.queueWait         = method.queueWait.snapshot(),
+			.handlerTime       = method.handlerTime.snapshot(),
+			.parseTime         = method.parseTime.snapshot(),
+			.serializationTime = method.serializationTime.snapshot(),
+			.receivedBytes     = method.receivedBytes.snapshot(),
+			.sentBytes         = method.sentBytes.snapshot()
+		});
+	};
+
+	for(std::size_t i = 0; i < message::MethodCount; ++i)
+	{
+		if(const auto* method = m_protocolMethods[i].load(std::memory_order_acquire))
+			addSnapshot(message::Methods[i], *method);
+	}
+
+	{
+		const auto lock = std::lock_guard(m_customMethodsMutex);
+
+		for(const auto& [name, method] : m_customMethods)
+			addSnapshot(name, *method);
+	}
+
+	std::ranges::sort(result, {}, &MethodSnapshot::method);
+
+	return result;
+}
+
+} // namespace lsp
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <lsp/strmap.h>
+
+namespace lsp{
+
+/*
+ * Log-linear histogram in the style of HdrHistogram.
+ * Every power of two range is split into 16 buckets, so recorded values are accurate to about 6%.
+ * Recording only updates a few atomic counters and can be done from any number of threads at once.
+ */
+class Histogram{
+public:
+	static constexpr unsigned int SubBucketBits  = 4;
+	static constexpr std::size_t  SubBucketCount = std::size_t(1) << SubBucketBits;
+	static constexpr std::size_t  BucketCount    = (64 - SubBucketBits + 1) * SubBucketCount;
+
+	struct Snapshot{
+		std::uint64_t              count = 0;
+		std::uint64_t              sum   = 0;
+		std::uint64_t              max   = 0;
+		std::vector<std::uint64_t> buckets; // Trailing empty buckets are left out
+
+		[[nodiscard]] double mean() const;
+		// Highest value that is equivalent to the one at the given percentile (0-100)
+		[[nodiscard]] std::uint64_t percentile(double percent) const;
+	};
+
+	Histogram() = default;
+	Histogram(const Histogram&) = delete;
+	Histogram& operator=(const Histogram&) = delete;
+
+	void record(std::uint64_t value);
+	void record(std::chrono::steady_clock::duration duration); // In nanoseconds
+
+	// Values that are recorded while the snapshot is taken might only be partially included
+	[[nodiscard]] Snapshot snapshot() const;
+
+	[[nodiscard]] static std::size_t bucketIndex(std::uint64_t value);
+	[[nodiscard]] static std::uint64_t bucketUpperBound(std::size_t index);
+
+private:
+	std::array<std::atomic<std::uint64_t>, BucketCount> m_buckets = {};
+	std::atomic<std::uint64_t>                          m_sum     = 0;
+	std::atomic<std::uint64_t>                          m_max     = 0;
+};
+
+/*
+ * Per method statistics of the messages that pass through a connection.
+ * Durations are recorded in nanoseconds and sizes in bytes.
+ */
+class MessageMetrics{
+public:
+	struct Method{
+		std::atomic<std::uint64_t> receivedCount = 0;
+		std::atomic<std::uint64_t> sentCount     = 0; // Requests and notifications with the method and responses to it
+		// Time between receiving a message and starting its asynchronous or serial work
+		Histogram                  queueWait;
+		// Time spent in the callback and evaluating the future returned by asynchronous callbacks
+		Histogram                  handlerTime;
+		// Parsing incoming messages and serializing outgoing ones
+		Histogram                  parseTime;
+		Histogram                  serializationTime;
+		Histogram                  receivedBytes;
+		Histogram                  sentBytes;
+	};
+
+	struct MethodSnapshot{
+		std::string         method;
+		std::uint64_t       receivedCount;
+		std::uint64_t       sentCount;
+		Histogram::Snapshot queueWait;
+		Histogram::Snapshot handlerTime;
+		Histogram::Snapshot parseTime;
+		Histogram::Snapshot serializationTime;
+		Histogram::Snapshot receivedBytes;
+		Histogram::Snapshot sentBytes;
+	};
+
+	// Methods that are not defined by the protocol share a single entry once there are this many of them
+	static constexpr std::size_t      MaxCustomMethods = 256;
+	static constexpr std::string_view OtherMethods     = "(other)";
+
+	MessageMetrics();
+	MessageMetrics(const MessageMetrics&) = delete;
+	MessageMetrics& operator=(const MessageMetrics&) = delete;
+	~MessageMetrics();
+
+	// The returned entry stays valid for the lifetime of the metrics.
+	// Looking up a method defined by the protocol does not lock.
+	[[nodiscard]] Method& method(std::string_view name);
+
+	// Only methods that were used, sorted by name
+	[[nodiscard]] std::vector<MethodSnapshot> snapshot() const;
+
+private:
+	std::unique_ptr<std::atomic<Method*>[]>      m_protocolMethods; // Indexed by message::methodIndex
+	mutable std::mutex                           m_customMethodsMutex;
+	StrMap<std::string, std::unique_ptr<Method>> m_customMethods;
+};
+
+} // namespace lsp
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <optional>
+#include <lsp/messagehandler.h>
+#include <lsp/messages.h>
+#include <lsp/serialization.h>
+
+namespace lsp{
+
+/*
+ * Sends the partial results of a request as $/progress notifications with the partialResultToken from the request params.
+ * Partial results are only sent if the other side provided a token. Once a partial result was sent, the final
+ * result of the request must not contain the items that were already reported, e.g. an empty array.
+ */
+template<typename M>
+requires message::IsRequest<M> && message::HasPartialResult<M>
+class PartialResults{
+public:
+	PartialResults(MessageHandler& messageHandler, const typename M::Params& params)
+		: m_messageHandler{messageHandler}
+		, m_token{params.partialResultToken}
+	{
+	}
+
+	[[nodiscard]] bool isEnabled() const{ return m_token.has_value(); }
+	[[nodiscard]] bool hasSent() const{ return m_sent; }
+
+	// Returns false without sending anything if partial results are not enabled
+	bool send(typename M::PartialResult&& partialResult)
+	{
+		if(!m_token.has_value())
+			return false;
+
+		m_messageHandler.sendNotification<notifications::Progress>({
+			.token = *m_token,
+			.value = toJson(std::move(partialResult))
+		});
+		m_sent = true;
+
+		return true;
+	}
+
+private:
+	MessageHandler&              m_messageHandler;
+	std::optional<ProgressToken> m_token;
+	bool                         m_sent = false;
+};
+
+} // namespace lsp
@@ -1,8 +1,13 @@
 #include <lsp/process.h>
 #include <lsp/io/stream.h>
+#include <lsp/io/uring.h>
 
 #ifndef LSP_PROCESS_UNSUPPORTED
 
+#if defined(LSP_USE_IO_URING) && defined(LSP_PROCESS_POSIX) && !defined(LSP_URING_UNSUPPORTED)
+	#define LSP_PROCESS_URING
+#endif
+
 #ifdef LSP_PROCESS_POSIX
 #include <cerrno>
 #include <stdio.h>
@@ -24,6 +29,10 @@ struct Process::Impl final : public io::Stream{
 	int   m_stdinWrite = -1;
 	int   m_stdoutRead = -1;
 	pid_t m_pid        = -1;
+#ifdef LSP_PROCESS_URING
+	io::LazyUring m_readRing;
+	io::LazyUring m_writeRing;
+#endif
 
 	Impl(const std::string& executable, const ArgList& args)
 	{
@@ -203,6 +212,14 @@ struct Process::Impl final : public io::Stream{
 
 	void read(char* buffer, std::size_t size) override
 	{
+#ifdef LSP_PROCESS_URING
+		if(auto* const ring = m_readRing.get())
+		{
+			ring->read(m_stdoutRead, buffer, size);
+			return;
+		}
+#endif
+
 		std::size_t totalBytesRead = 0;
 
 		while(totalBytesRead < size)
@@ -223,6 +240,14 @@ struct Process::Impl final : public io::Stream{
 
 	void write(const char* buffer, std::size_t size) override
 	{
+#ifdef LSP_PROCESS_URING
+		if(auto* const ring = m_writeRing.get())
+		{
+			ring->write(m_stdinWrite, buffer, size);
+			return;
+		}
+#endif
+
 		std::size_t totalBytesWritten = 0;
 
 		while(totalBytesWritten < size)
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <lsp/error.h>
+
+namespace lsp{
+
+/*
+ * Callback based alternative to std::future for asynchronous handlers.
+ * A handler returns the promise and fulfills it later from any thread. The callback registered with onReady runs
+ * on the thread that fulfills the promise, so no thread has to wait while the result is being computed.
+ * Copies share the same state. If the last copy is destroyed before the promise was fulfilled it is fulfilled
+ * with a RequestError so that the request still receives a response.
+ * A promise returned from a request handler may outlive its lsp::MessageHandler. The handler does not wait for it
+ * when it is destroyed and fulfilling the promise afterwards does nothing since the response can't be sent anymore.
+ */
+template<typename T>
+class Promise{
+public:
+	using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+	/*
+	 * The value or exception the promise was fulfilled with
+	 */
+	class Result{
+	public:
+		// Returns the value or rethrows the exception
+		Value get() &&
+		{
+			if(m_exception)
+				std::rethrow_exception(m_exception);
+
+			return std::move(*m_value);
+		}
+
+	private:
+		friend class Promise;
+		std::optional<Value> m_value;
+		std::exception_ptr   m_exception;
+	};
+
+	using Callback = std::function<void(Result&&)>;
+
+	Promise()
+		: m_state{std::make_shared<State>()}
+	{
+	}
+
+	Promise(const Promise& other)
+		: m_state{other.m_state}
+	{
+		if(m_state)
+			m_state->handleCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Promise(Promise&& other) noexcept = default;
+
+	Promise& operator=(Promise other) noexcept
+	{
+		std::swap(m_state, other.m_state);
+		return *this;
+	}
+
+	~Promise()
+	{
+		if(m_state && m_state->handleCount.fetch_sub(1, std::memory_order_acq_rel) == 1 && !isReady())
+		{
+			// The callback usually sends the response, which throws if the connection was closed in the meantime.
+			// Nobody is left to report that to and the exception must not escape the destructor.
+			try
+			{
+				setException(std::make_exception_ptr(RequestError(MessageError::InternalError, "Promise was destroyed before it was fulfilled")));
+			}
+			catch(...)
+			{
+			}
+		}
+	}
+
+	template<typename... Args>
+	void setValue(Args&&... args)
+	{
+		auto result = Result();
+		result.m_value.emplace(std::forward<Args>(args)...);
+		fulfill(std::move(result));
+	}
+
+	void setException(std::exception_ptr exception)
+	{
+		auto result = Result();
+		result.m_exception = std::move(exception);
+		fulfill(std::move(result));
+	}
+
+	[[nodiscard]] bool isReady() const
+	{
+		const auto lock = std::lock_guard(m_state->mutex);
+		return m_state->fulfilled;
+	}
+
+	// Only one callback can be registered. It is called immediately if the promise was already fulfilled.
+	void onReady(Callback callback)
+	{
+		std::optional<Result> result;
+
+		{
+			const auto lock = std::lock_guard(m_state->mutex);
+
+			if(!m_state->result.has_value())
+			{
+				m_state->callback = std::move(callback);
+				return;
+			}
+
+			result = std::move(m_state->result);
+		}
+
+		callback(std::move(*result));
+	}
+
+private:
+	struct State{
+		std::mutex            mutex;
+		std::optional<Result> result;
+		Callback              callback;
+		bool                  fulfilled   = false;
+		std::atomic<unsigned> handleCount = 1;
+	};
+
+	std::shared_ptr<State> m_state;
+
+	void fulfill(Result&& result)
+	{
+		Callback callback;
+
+		{
+			const auto lock = std::lock_guard(m_state->mutex);
+
+			// Only the first value or exception counts
+			if(m_state->fulfilled)
+				return;
+
+			m_state->fulfilled = true;
+
+			if(!m_state->callback)
+			{
+				m_state->result = std::move(result);
+				return;
+			}
+
+			callback = std::move(m_state->callback);
+		}
+
+		callback(std::move(result));
+	}
+};
+
+} // namespace lsp
@@ -2,6 +2,8 @@
 
 #include <future>
 #include <lsp/jsonrpc/jsonrpc.h>
+#include <lsp/promise.h>
+#include <lsp/task.h>
 
 namespace lsp{
 
@@ -15,6 +17,23 @@ using AsyncRequestResult = std::future<typename MessageType::Result>;
 
 using AsyncNotificationResult = std::future<void>;
 
+/*
+ * Alternative to AsyncRequestResult that doesn't occupy a worker thread while the result is computed.
+ * The response is sent as soon as the promise is fulfilled.
+ */
+template<typename MessageType>
+using RequestPromise = Promise<typename MessageType::Result>;
+
+using NotificationPromise = Promise<void>;
+
+/*
+ * Coroutine handlers. They run on the message thread until they first suspend.
+ */
+template<typename MessageType>
+using RequestTask = Task<typename MessageType::Result>;
+
+using NotificationTask = Task<void>;
+
 /*
  * The return type of MessageHandler::sendRequest.
  * id can be used to send a cancel notification (if the request supports it).
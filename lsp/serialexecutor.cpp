@@ -0,0 +1,151 @@
+#include <utility>
+#include <lsp/serialexecutor.h>
+
+namespace lsp{
+
+/*
+ * SerialExecutor::KeyRunner
+ * Discards the queue of its key if it is discarded or destroyed without having been run
+ */
+
+class SerialExecutor::KeyRunner{
+public:
+	KeyRunner(SerialExecutor& executor, std::string key)
+		: m_executor{&executor}
+		, m_key{std::move(key)}
+	{
+	}
+
+	KeyRunner(KeyRunner&& other) noexcept
+		: m_executor{std::exchange(other.m_executor, nullptr)}
+		, m_key{std::move(other.m_key)}
+	{
+	}
+
+	KeyRunner& operator=(KeyRunner&&) = delete;
+
+	~KeyRunner()
+	{
+		if(m_executor)
+			m_executor->dropQueue(m_key);
+	}
+
+	void operator()()
+	{
+		std::exchange(m_executor, nullptr)->runNext(m_key);
+	}
+
+	void discard()
+	{
+		std::exchange(m_executor, nullptr)->dropQueue(m_key);
+	}
+
+private:
+	SerialExecutor* m_executor;
+	std::string     m_key;
+};
+
+/*
+ * SerialExecutor
+ */
+
+SerialExecutor::SerialExecutor(ThreadPool& threadPool)
+	: m_threadPool{threadPool}
+{
+}
+
+std::size_t SerialExecutor::activeKeyCount() const
+{
+	const auto lock = std::lock_guard(m_mutex);
+	return m_queues.size();
+}
+
+void SerialExecutor::post(std::string_view key, TaskPtr task, TaskPriority priority)
+{
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		auto       it   = m_queues.find(key);
+
+		if(it != m_queues.end())
+		{
+			// Run once the tasks before it have finished
+			it->second.push_back({std::move(task), priority});
+			return;
+		}
+
+		m_queues[std::string(key)].push_back({std::move(task), priority});
+	}
+
+	m_threadPool.post(priority, KeyRunner(*this, std::string(key)));
+}
+
+void SerialExecutor::runNext(const std::string& key)
+{
+	TaskBase* task = nullptr;
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		task = m_queues.find(key)->second.front().task.get();
+	}
+
+	// Only this thread removes the front task of the queue so it stays alive while it is running
+	try
+	{
+		task->run();
+	}
+	catch(...)
+	{
+	}
+
+	auto finished     = TaskPtr();
+	auto nextPriority = TaskPriority::Normal;
+
+	{
+		const auto lock  = std::lock_guard(m_mutex);
+		const auto it    = m_queues.find(key);
+		auto&      queue = it->second;
+
+		finished = std::move(queue.front().task);
+		queue.pop_front();
+
+		if(queue.empty())
+		{
+			m_queues.erase(it);
+			return;
+		}
+
+		nextPriority = queue.front().priority;
+	}
+
+	// Every task is posted separately so that other keys get a turn in between
+	m_threadPool.post(nextPriority, KeyRunner(*this, key));
+}
+
+void SerialExecutor::dropQueue(const std::string& key)
+{
+	auto dropped = std::deque<QueuedTask>(); // Discarded after the lock is released
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		const auto it   = m_queues.find(key);
+
+		if(it == m_queues.end())
+			return;
+
+		dropped = std::move(it->second);
+		m_queues.erase(it);
+	}
+
+	for(auto& queued : dropped)
+	{
+		try
+		{
+			queued.task->discard();
+		}
+		catch(...)
+		{
+		}
+	}
+}
+
+} // namespace lsp
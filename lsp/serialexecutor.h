@@ -0,0 +1,89 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <lsp/strmap.h>
+#include <lsp/threadpool.h>
+
+namespace lsp{
+
+/*
+ * Runs tasks on a thread pool one after another for each key.
+ * Tasks with the same key run in the order they were posted, tasks with different keys run concurrently.
+ * Every key only occupies a worker thread while one of its tasks is running.
+ * The thread pool must outlive the executor and the executor must outlive the tasks that were posted to it.
+ * If ThreadPool::stop discards the task that would run next for a key, the remaining tasks of the key are discarded as well.
+ * Like with ThreadPool::post, a task can have a discard member function that is called instead of running it.
+ */
+class SerialExecutor{
+public:
+	explicit SerialExecutor(ThreadPool& threadPool);
+	SerialExecutor(const SerialExecutor&) = delete;
+	SerialExecutor& operator=(const SerialExecutor&) = delete;
+
+	// Exceptions thrown by f are ignored
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	void post(std::string_view key, TaskPriority priority, F&& f)
+	{
+		post(key, std::make_unique<Task<std::decay_t<F>>>(std::forward<F>(f)), priority);
+	}
+
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	void post(std::string_view key, F&& f)
+	{
+		post(key, TaskPriority::Normal, std::forward<F>(f));
+	}
+
+	// Number of keys with queued or running tasks
+	[[nodiscard]] std::size_t activeKeyCount() const;
+
+private:
+	struct TaskBase{
+		virtual ~TaskBase() = default;
+		virtual void run() = 0;
+		virtual void discard() = 0;
+	};
+
+	template<typename F>
+	struct Task final : TaskBase{
+		F callback;
+
+		explicit Task(F&& f) : callback{std::move(f)}{}
+		explicit Task(const F& f) : callback{f}{}
+
+		void run() override{ std::invoke(callback); }
+
+		void discard() override
+		{
+			if constexpr(requires{ callback.discard(); })
+				callback.discard();
+		}
+	};
+
+	using TaskPtr = std::unique_ptr<TaskBase>;
+
+	struct QueuedTask{
+		TaskPtr      task;
+		TaskPriority priority;
+	};
+
+	using KeyQueues = StrMap<std::string, std::deque<QueuedTask>>;
+
+	ThreadPool&        m_threadPool;
+	mutable std::mutex m_mutex;
+	KeyQueues          m_queues; // The first task of a queue is the one that is running or about to run
+
+	// Posted to the pool to run the next task of a key
+	class KeyRunner;
+
+	void post(std::string_view key, TaskPtr task, TaskPriority priority);
+	void runNext(const std::string& key);
+	void dropQueue(const std::string& key);
+};
+
+} // namespace lsp
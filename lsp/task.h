@@ -0,0 +1,109 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <lsp/promise.h>
+
+namespace lsp{
+
+/*
+ * Awaiting a promise suspends the coroutine until the promise is fulfilled.
+ * The coroutine is resumed on the thread that fulfills the promise.
+ * The awaiter doesn't keep the promise alive, so a promise that is abandoned by everyone else
+ * resumes the coroutine with an exception instead of suspending it forever.
+ */
+template<typename T>
+class PromiseAwaiter{
+public:
+	explicit PromiseAwaiter(Promise<T> promise)
+		: m_promise{std::move(promise)}
+	{
+	}
+
+	bool await_ready() const noexcept{ return false; }
+
+	void await_suspend(std::coroutine_handle<> coroutine)
+	{
+		// The coroutine might be resumed and destroyed before onReady returns so the awaiter must not be accessed afterwards
+		auto promise = std::move(m_promise);
+		promise.onReady([this, coroutine](typename Promise<T>::Result&& result)
+		{
+			m_result.emplace(std::move(result));
+			coroutine.resume();
+		});
+	}
+
+	T await_resume()
+	{
+		if constexpr(std::is_void_v<T>)
+			std::move(*m_result).get();
+		else
+			return std::move(*m_result).get();
+	}
+
+private:
+	Promise<T>                                 m_promise;
+	std::optional<typename Promise<T>::Result> m_result;
+};
+
+template<typename T>
+PromiseAwaiter<T> operator co_await(Promise<T> promise)
+{
+	return PromiseAwaiter<T>(std::move(promise));
+}
+
+template<typename T>
+class Task;
+
+namespace detail{
+
+template<typename T>
+struct TaskPromiseBase{
+	Promise<T> result;
+
+	template<typename V>
+	void return_value(V&& value){ result.setValue(std::forward<V>(value)); }
+};
+
+template<>
+struct TaskPromiseBase<void>{
+	Promise<void> result;
+
+	void return_void(){ result.setValue(); }
+};
+
+} // namespace detail
+
+/*
+ * Coroutine type for handlers and other asynchronous code.
+ * The coroutine starts running immediately and its frame is destroyed once it finishes.
+ * The outcome is reported through the Promise returned by promise(). A task can be awaited by other coroutines.
+ */
+template<typename T>
+class Task{
+public:
+	struct promise_type : detail::TaskPromiseBase<T>{
+		Task get_return_object(){ return Task(this->result); }
+		std::suspend_never initial_suspend() noexcept{ return {}; }
+		std::suspend_never final_suspend() noexcept{ return {}; }
+		void unhandled_exception(){ this->result.setException(std::current_exception()); }
+	};
+
+	[[nodiscard]] const Promise<T>& promise() const &{ return m_promise; }
+	[[nodiscard]] Promise<T> promise() &&{ return std::move(m_promise); }
+
+	PromiseAwaiter<T> operator co_await() &&{ return PromiseAwaiter<T>(std::move(m_promise)); }
+
+private:
+	Promise<T> m_promise;
+
+	explicit Task(Promise<T> promise)
+		: m_promise{std::move(promise)}
+	{
+	}
+};
+
+} // namespace lsp
@@ -1,88 +1,830 @@
+#include <algorithm>
+#include <exception>
+#include <utility>
 #include <lsp/threadpool.h>
 
 namespace lsp{
+namespace{
 
-ThreadPool::ThreadPool(unsigned int initialThreads, unsigned int maxThreads)
-	: m_maxThreads{std::max(maxThreads, 1u)}
+struct CurrentWorker{
+	const ThreadPool* pool  = nullptr;
+	unsigned int      index = 0;
+};
+
+thread_local CurrentWorker t_currentWorker;
+
+/*
+ * Recycled task memory.
+ * Posted tasks are usually created on one thread and destroyed on another. Every thread keeps its own
+ * free blocks and exchanges whole batches with the other threads so that the shared list is rarely locked.
+ */
+
+constexpr std::size_t TaskMemoryBatchSize  = 32;
+constexpr std::size_t MaxSharedTaskBatches = 64;
+
+struct SharedTaskMemory{
+	std::mutex                      mutex;
+	std::vector<std::vector<void*>> batches;
+	std::vector<std::vector<void*>> emptyBatches; // Reused so exchanging batches does not allocate either
+
+	~SharedTaskMemory()
+	{
+		for(const auto& batch : batches)
+		{
+			for(auto* block : batch)
+				::operator delete(block);
+		}
+	}
+};
+
+SharedTaskMemory& sharedTaskMemory()
+{
+	static SharedTaskMemory memory;
+	return memory;
+}
+
+struct LocalTaskMemory{
+	std::vector<void*> blocks;
+
+	~LocalTaskMemory()
+	{
+		for(auto* block : blocks)
+			::operator delete(block);
+	}
+};
+
+thread_local LocalTaskMemory t_taskMemory;
+
+/*
+ * Chunks of a parallel loop.
+ * Chunks are claimed by the calling thread and by helper tasks until none are left. Helper tasks that run late
+ * don't find anything to do and never touch the loop body which might not exist anymore.
+ */
+struct ForkJoin{
+	void (*runChunk)(void*, std::size_t);
+	void*                    context;
+	std::size_t              chunkCount;
+	std::atomic<std::size_t> nextChunk      = 0;
+	std::atomic<std::size_t> finishedChunks = 0;
+	std::atomic<bool>        failed         = false;
+	std::mutex               exceptionMutex;
+	std::exception_ptr       exception;
+
+	ForkJoin(void (*runChunk)(void*, std::size_t), void* context, std::size_t chunkCount)
+		: runChunk{runChunk}
+		, context{context}
+		, chunkCount{chunkCount}
+	{
+	}
+
+	// Returns false once every chunk has been claimed
+	bool runNextChunk()
+	{
+		const auto chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+
+		if(chunk >= chunkCount)
+			return false;
+
+		if(!failed.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				runChunk(context, chunk);
+			}
+			catch(...)
+			{
+				const auto lock = std::lock_guard(exceptionMutex);
+
+				if(!exception)
+					exception = std::current_exception();
+
+				failed.store(true, std::memory_order_relaxed);
+			}
+		}
+
+		if(finishedChunks.fetch_add(1, std::memory_order_acq_rel) + 1 == chunkCount)
+			finishedChunks.notify_all();
+
+		return true;
+	}
+};
+
+std::uint32_t nextRandom(std::uint32_t& state)
+{
+	// xorshift32
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+} // namespace
+
+/*
+ * Tasks
+ */
+
+void ThreadPool::TaskDeleter::operator()(TaskBase* task) const
+{
+	task->destroy();
+}
+
+void ThreadPool::PostedTask::execute()
 {
-	const auto lock = std::lock_guard(m_mutex);
-	m_threads.reserve(initialThreads);
-	m_waitForNewTasks = true;
+	try
+	{
+		m_invoke(m_storage);
+	}
+	catch(...)
+	{
+		// Nobody is waiting for the result
+	}
+}
+
+void ThreadPool::PostedTask::discard()
+{
+	if(!m_discard)
+		return;
+
+	try
+	{
+		m_discard(m_storage);
+	}
+	catch(...)
+	{
+	}
+}
+
+void ThreadPool::PostedTask::destroy()
+{
+	m_destroy(m_storage);
+	this->~PostedTask();
+	deallocate(this);
+}
+
+void* ThreadPool::PostedTask::allocate()
+{
+	auto& blocks = t_taskMemory.blocks;
+
+	if(blocks.empty())
+	{
+		auto&      shared = sharedTaskMemory();
+		const auto lock   = std::lock_guard(shared.mutex);
+
+		if(!shared.batches.empty())
+		{
+			std::swap(blocks, shared.batches.back());
+			shared.emptyBatches.push_back(std::move(shared.batches.back()));
+			shared.batches.pop_back();
+		}
+	}
+
+	if(blocks.empty())
+		return ::operator new(sizeof(PostedTask));
+
+	auto* block = blocks.back();
+	blocks.pop_back();
+
+	return block;
+}
+
+void ThreadPool::PostedTask::deallocate(void* memory)
+{
+	auto& blocks = t_taskMemory.blocks;
+	blocks.push_back(memory);
+
+	if(blocks.size() < 2 * TaskMemoryBatchSize)
+		return;
+
+	// Hand a batch to the threads that allocate
+	const auto batchBegin = blocks.end() - TaskMemoryBatchSize;
+
+	{
+		auto&      shared = sharedTaskMemory();
+		const auto lock   = std::lock_guard(shared.mutex);
+
+		if(shared.batches.size() < MaxSharedTaskBatches)
+		{
+			auto batch = std::vector<void*>();
 
-	for(std::size_t i = 0; i < initialThreads; ++i)
+			if(!shared.emptyBatches.empty())
+			{
+				batch = std::move(shared.emptyBatches.back());
+				shared.emptyBatches.pop_back();
+			}
+
+			batch.assign(batchBegin, blocks.end());
+			shared.batches.push_back(std::move(batch));
+			blocks.erase(batchBegin, blocks.end());
+			return;
+		}
+	}
+
+	std::for_each(batchBegin, blocks.end(), [](void* block){ ::operator delete(block); });
+	blocks.erase(batchBegin, blocks.end());
+}
+
+/*
+ * TaskDeque
+ */
+
+ThreadPool::TaskDeque::Buffer::Buffer(std::int64_t capacity)
+	: capacity{capacity}
+	, tasks{std::make_unique<std::atomic<TaskBase*>[]>(static_cast<std::size_t>(capacity))}
+{
+	assert((capacity & (capacity - 1)) == 0);
+}
+
+ThreadPool::TaskDeque::TaskDeque()
+{
+	m_buffers.push_back(std::make_unique<Buffer>(64));
+	m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+}
+
+ThreadPool::TaskDeque::~TaskDeque()
+{
+	while(auto* task = pop())
+		task->destroy();
+}
+
+void ThreadPool::TaskDeque::push(TaskBase* task)
+{
+	const auto bottom = m_bottom.load(std::memory_order_relaxed);
+	const auto top    = m_top.load(std::memory_order_acquire);
+	auto*      buffer = m_buffer.load(std::memory_order_relaxed);
+
+	if(bottom - top > buffer->capacity - 1)
+		buffer = replaceBuffer(buffer->capacity * 2);
+
+	buffer->put(bottom, task);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+void ThreadPool::TaskDeque::moveToLocalMemory()
+{
+	replaceBuffer(m_buffer.load(std::memory_order_relaxed)->capacity);
+}
+
+ThreadPool::TaskDeque::Buffer* ThreadPool::TaskDeque::replaceBuffer(std::int64_t capacity)
+{
+	// Owner only
+	const auto bottom   = m_bottom.load(std::memory_order_relaxed);
+	const auto top      = m_top.load(std::memory_order_acquire);
+	auto*      buffer   = m_buffer.load(std::memory_order_relaxed);
+	auto       replaced = std::make_unique<Buffer>(capacity);
+
+	for(auto i = top; i < bottom; ++i)
+		replaced->put(i, buffer->get(i));
+
+	buffer = replaced.get();
+	m_buffers.push_back(std::move(replaced));
+	m_buffer.store(buffer, std::memory_order_release);
+
+	return buffer;
+}
+
+ThreadPool::TaskBase* ThreadPool::TaskDeque::pop()
+{
+	const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	auto*      buffer = m_buffer.load(std::memory_order_relaxed);
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	auto top = m_top.load(std::memory_order_relaxed);
+
+	if(top > bottom) // Empty
+	{
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto* task = buffer->get(bottom);
+
+	if(top == bottom) // Last task. Thieves might be trying to take it at the same time.
+	{
+		if(!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			task = nullptr;
+
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	return task;
+}
+
+ThreadPool::TaskBase* ThreadPool::TaskDeque::steal()
+{
+	auto top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const auto bottom = m_bottom.load(std::memory_order_acquire);
+
+	if(top >= bottom)
+		return nullptr;
+
+	auto* task = m_buffer.load(std::memory_order_acquire)->get(top);
+
+	// Lost the race against the owner or another thief
+	if(!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+
+	return task;
+}
+
+/*
+ * ThreadPool
+ */
+
+ThreadPool::ThreadPool(const ThreadPoolOptions& options)
+	: m_minThreads{std::min(options.minThreads, std::max(options.maxThreads, 1u))}
+	, m_maxThreads{std::max(options.maxThreads, 1u)}
+	, m_idleTimeout{options.idleTimeout}
+	, m_affinity{options.affinity}
+	, m_workers{std::make_unique<Worker[]>(m_maxThreads)}
+	, m_timers{std::make_unique<TimerWheel>(std::chrono::milliseconds(1))}
+{
+	const auto lock = std::lock_guard(m_threadsMutex);
+	m_threads.resize(m_maxThreads);
+
+	for(std::size_t i = 0; i < m_minThreads; ++i)
 		addThread();
 }
 
+ThreadPool::ThreadPool(unsigned int initialThreads, unsigned int maxThreads)
+	: ThreadPool(ThreadPoolOptions{.minThreads = initialThreads, .maxThreads = maxThreads})
+{
+}
+
 ThreadPool::~ThreadPool()
 {
+	// Timer callbacks post to the pool so they have to be stopped first
+	m_timers.reset();
 	waitUntilFinished();
 }
 
+bool ThreadPool::cancelTimer(TimerId id)
+{
+	return m_timers->cancel(id);
+}
+
+void ThreadPool::forkJoin(std::size_t chunkCount, void (*runChunk)(void* context, std::size_t chunk), void* context)
+{
+	if(chunkCount == 1)
+	{
+		runChunk(context, 0);
+		return;
+	}
+
+	auto state = std::make_shared<ForkJoin>(runChunk, context, chunkCount);
+
+	for(std::size_t i = 0; i < std::min<std::size_t>(chunkCount - 1, m_maxThreads); ++i)
+	{
+		post([state](){
+			while(state->runNextChunk()){}
+		});
+	}
+
+	while(state->runNextChunk()){}
+
+	// Only chunks that are already running are left
+	for(auto finished = state->finishedChunks.load(std::memory_order_acquire); finished != chunkCount; finished = state->finishedChunks.load(std::memory_order_acquire))
+		state->finishedChunks.wait(finished, std::memory_order_acquire);
+
+	if(state->exception)
+		std::rethrow_exception(state->exception);
+}
+
+std::size_t ThreadPool::defaultGrain(std::size_t count) const
+{
+	// A few chunks per thread so that uneven chunks can be balanced
+	return std::max<std::size_t>(count / (4 * std::size_t(m_maxThreads)), 1);
+}
+
 void ThreadPool::waitUntilFinished()
 {
 	{
-		const auto lock = std::lock_guard(m_mutex);
-		m_waitForNewTasks = false;
+		const auto lock = std::lock_guard(m_stateMutex);
+		m_acceptingTasks = false;
+	}
+
+	std::vector<std::thread> threads;
+
+	{
+		// Workers exit once they are stopping and there are no more tasks
+		const auto lock = std::lock_guard(m_threadsMutex);
+		m_stopping.store(true);
+		threads = std::exchange(m_threads, std::vector<std::thread>(m_maxThreads));
+	}
+
+	{
+		const auto lock = std::lock_guard(m_parkMutex);
+		m_wakeEpoch.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	m_event.notify_all();
+	m_parkEvent.notify_all();
 
-	for(auto& t : m_threads)
-		t.join();
+	for(auto& t : threads)
+	{
+		if(t.joinable())
+			t.join();
+	}
 
 	{
-		const auto lock = std::lock_guard(m_mutex);
-		m_threads.clear();
-		m_waitForNewTasks = true;
+		const auto lock = std::lock_guard(m_threadsMutex);
+		m_workerCount.store(0);
+		m_slotCount.store(0);
+		m_freeSlots.clear();
+		m_stopping.store(false);
+	}
+
+	{
+		const auto lock = std::lock_guard(m_stateMutex);
+		m_acceptingTasks = true;
 	}
 
 	// Notify threads waiting in addTask
-	m_event.notify_all();
+	m_stateEvent.notify_all();
+
+	// A task might have been added while the workers were exiting
+	if(hasQueuedTasks())
+	{
+		const auto lock = std::lock_guard(m_threadsMutex);
+
+		if(m_workerCount.load() == 0)
+			addThread();
+	}
 }
 
-void ThreadPool::addTask(TaskPtr task)
+std::future<void> ThreadPool::drain()
 {
-	auto lock = std::unique_lock(m_mutex);
+	auto promise = std::promise<void>();
+	auto future  = promise.get_future();
 
-	if(!m_waitForNewTasks)
-		m_event.wait(lock, [this](){ return m_waitForNewTasks; });
+	{
+		const auto lock = std::lock_guard(m_drainMutex);
 
-	m_taskQueue.emplace(std::move(task));
+		// Fulfilled by the worker that finishes the last task
+		if(m_pendingCount.load(std::memory_order_acquire) > 0)
+		{
+			m_drainPromises.push_back(std::move(promise));
+			return future;
+		}
+	}
 
-	if((m_taskQueue.size() > 1 && m_threads.size() < m_maxThreads) || m_threads.empty())
-		addThread();
+	promise.set_value();
 
-	lock.unlock();
-	m_event.notify_one();
+	return future;
 }
 
-void ThreadPool::addThread()
+std::size_t ThreadPool::stop(std::chrono::steady_clock::time_point deadline)
 {
-	m_threads.emplace_back([this]()
+	const auto lock = std::lock_guard(m_stopMutex);
+
+	if(drain().wait_until(deadline) == std::future_status::ready)
+		return 0;
+
+	// Workers keep taking tasks but destroy them instead of running them until the pool is drained
+	m_discarding.store(true);
+	drain().wait();
+	m_discarding.store(false);
+
+	return m_discardedCount.exchange(0);
+}
+
+void ThreadPool::addTask(TaskPtr task, TaskPriority priority)
+{
+	const auto index = static_cast<std::size_t>(priority);
+
+	// Tasks added by a worker of this pool go to its own deque
+	if(t_currentWorker.pool == this)
+	{
+		m_pendingCount.fetch_add(1, std::memory_order_relaxed);
+		m_queuedCounts[index].value.fetch_add(1, std::memory_order_relaxed);
+		m_workers[t_currentWorker.index].deques[index].push(task.release());
+	}
+	else
+	{
+		if(m_stopping.load())
+		{
+			auto lock = std::unique_lock(m_stateMutex);
+			m_stateEvent.wait(lock, [this](){ return m_acceptingTasks; });
+		}
+
+		m_pendingCount.fetch_add(1, std::memory_order_relaxed);
+		m_queuedCounts[index].value.fetch_add(1, std::memory_order_relaxed);
+
+		const auto lock = std::lock_guard(m_injectionMutex);
+		m_injectedTasks[index].push_back(std::move(task));
+	}
+
+	// Pairs with the fence in runWorker so that either the task is seen before parking or the parked worker is seen here
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	const auto parkedCount = m_parkedCount.load(std::memory_order_relaxed);
+
+	if(parkedCount > 0)
+		wakeWorker();
+
+	const auto workerCount = m_workerCount.load();
+
+	if(workerCount < m_maxThreads)
 	{
-		while(true)
+		auto queuedCount = std::int64_t(0);
+
+		for(const auto& count : m_queuedCounts)
+			queuedCount += count.value.load(std::memory_order_relaxed);
+
+		// More tasks are waiting than there are idle workers to take them
+		if(queuedCount > static_cast<std::int64_t>(parkedCount) + 1 || workerCount == 0)
 		{
-			TaskPtr task;
+			const auto lock = std::lock_guard(m_threadsMutex);
+
+			if(!m_stopping.load() && m_workerCount.load() < m_maxThreads)
+				addThread();
+		}
+	}
+}
+
+ThreadPool::Stats ThreadPool::stats() const
+{
+	const auto threadCount = m_workerCount.load();
+	const auto idleCount   = std::min(m_parkedCount.load(), threadCount);
+	auto       queuedCount = std::int64_t(0);
+
+	for(const auto& count : m_queuedCounts)
+		queuedCount += std::max(count.value.load(), std::int64_t(0));
 
+	return {
+		.threadCount       = threadCount,
+		.activeThreadCount = threadCount - idleCount,
+		.idleThreadCount   = idleCount,
+		.queuedTaskCount   = static_cast<std::size_t>(queuedCount)
+	};
+}
+
+void ThreadPool::addThread()
+{
+	// Must be called with m_threadsMutex locked
+	assert(m_workerCount.load() < m_maxThreads);
+	auto slot = m_slotCount.load();
+
+	if(!m_freeSlots.empty())
+	{
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+	else
+	{
+		m_slotCount.store(slot + 1);
+	}
+
+	// The thread that used the slot before has already left runWorker
+	if(m_threads[slot].joinable())
+		m_threads[slot].join();
+
+	m_workers[slot].skippedCounts = {};
+	m_workers[slot].randomState   = slot * 2654435761u + 1;
+	m_workerCount.fetch_add(1);
+	m_threads[slot] = std::thread(&ThreadPool::runWorker, this, slot);
+}
+
+void ThreadPool::runWorker(unsigned int slot)
+{
+	t_currentWorker = {this, slot};
+	auto& worker = m_workers[slot];
+
+	// The slot is pinned to the same CPU every time so its deques only have to be moved once
+	if(setThreadAffinity(m_affinity, slot) && !worker.localMemory)
+	{
+		for(auto& deque : worker.deques)
+			deque.moveToLocalMemory();
+
+		worker.localMemory = true;
+	}
+
+	while(true)
+	{
+		if(auto task = findTask(worker))
+		{
+			if(!m_discarding.load(std::memory_order_relaxed))
 			{
-				auto lock = std::unique_lock(m_mutex);
+				task->execute();
+			}
+			else
+			{
+				task->discard();
+				m_discardedCount.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			task.reset();
+			finishTask();
+			continue;
+		}
 
-				if(m_waitForNewTasks && m_taskQueue.empty())
-					m_event.wait(lock, [this](){ return !m_waitForNewTasks || !m_taskQueue.empty(); });
+		if(!park(slot))
+			break;
+	}
+
+	t_currentWorker = {};
+}
+
+void ThreadPool::finishTask()
+{
+	if(m_pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
 
-				if(!m_taskQueue.empty())
-				{
-					task = std::move(m_taskQueue.front());
-					m_taskQueue.pop();
-				}
+	auto promises = std::vector<std::promise<void>>();
+
+	{
+		const auto lock = std::lock_guard(m_drainMutex);
+
+		// Another task might have been added in the meantime
+		if(m_pendingCount.load(std::memory_order_acquire) != 0)
+			return;
+
+		promises.swap(m_drainPromises);
+	}
+
+	for(auto& promise : promises)
+		promise.set_value();
+}
+
+bool ThreadPool::park(unsigned int slot)
+{
+	// Returns false if the worker should exit
+	const auto epoch = m_wakeEpoch.load();
+	m_parkedCount.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if(hasQueuedTasks())
+	{
+		m_parkedCount.fetch_sub(1);
+		return true;
+	}
+
+	if(m_stopping.load())
+	{
+		m_parkedCount.fetch_sub(1);
+		return false;
+	}
+
+	auto timedOut = false;
+
+	{
+		auto       lock  = std::unique_lock(m_parkMutex);
+		const auto woken = [this, epoch](){ return m_wakeEpoch.load(std::memory_order_relaxed) != epoch; };
+
+		if(m_workerCount.load() <= m_minThreads)
+			m_parkEvent.wait(lock, woken);
+		else
+			timedOut = !m_parkEvent.wait_for(lock, m_idleTimeout, woken);
+	}
+
+	if(timedOut)
+	{
+		const auto lock = std::lock_guard(m_threadsMutex);
+
+		if(!m_stopping.load() && m_workerCount.load() > m_minThreads)
+		{
+			m_workerCount.fetch_sub(1);
+			m_parkedCount.fetch_sub(1);
+			// Pairs with the fence in addTask. A task that was added in the meantime either sees fewer parked workers or is seen here.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if(!hasQueuedTasks())
+			{
+				m_freeSlots.push_back(slot);
+				return false;
 			}
 
-			if(!task) // No more tasks in the queue. Thread was notified to exit.
-				break;
+			m_workerCount.fetch_add(1);
+			m_parkedCount.fetch_add(1);
+		}
+	}
+
+	m_parkedCount.fetch_sub(1);
+
+	return true;
+}
 
-			task->execute();
+ThreadPool::TaskPtr ThreadPool::findTask(Worker& worker)
+{
+	// A starved lower priority is searched first
+	auto order = std::array<std::size_t, PriorityCount>();
+
+	for(std::size_t i = 0; i < PriorityCount; ++i)
+		order[i] = i;
+
+	for(std::size_t priority = 1; priority < PriorityCount; ++priority)
+	{
+		if(worker.skippedCounts[priority] >= StarvationLimit && m_queuedCounts[priority].value.load(std::memory_order_relaxed) > 0)
+		{
+			std::rotate(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(priority), order.begin() + static_cast<std::ptrdiff_t>(priority) + 1);
+			break;
 		}
+	}
+
+	for(const auto priority : order)
+	{
+		if(m_queuedCounts[priority].value.load(std::memory_order_relaxed) <= 0)
+			continue;
+
+		auto* task = worker.deques[priority].pop();
+
+		if(!task)
+			task = takeInjectedTask(worker, priority);
+
+		if(!task)
+			task = stealTask(worker, priority);
+
+		if(!task)
+			continue;
+
+		m_queuedCounts[priority].value.fetch_sub(1, std::memory_order_relaxed);
+
+		for(std::size_t other = 0; other < PriorityCount; ++other)
+		{
+			if(other != priority && m_queuedCounts[other].value.load(std::memory_order_relaxed) > 0)
+				++worker.skippedCounts[other];
+		}
+
+		worker.skippedCounts[priority] = 0;
+
+		return TaskPtr(task);
+	}
+
+	return nullptr;
+}
+
+ThreadPool::TaskBase* ThreadPool::takeInjectedTask(Worker& worker, std::size_t priority)
+{
+	TaskBase*   task      = nullptr;
+	std::size_t movedCount = 0;
+
+	{
+		const auto lock = std::lock_guard(m_injectionMutex);
+		auto&      queue = m_injectedTasks[priority];
+
+		if(queue.empty())
+			return nullptr;
+
+		task = queue.front().release();
+		queue.pop_front();
+
+		// Take a share of the remaining tasks so that the injection queue is locked less often.
+		// Other workers can still steal them.
+		movedCount = std::min(queue.size() / 2, InjectionBatchSize);
+
+		for(std::size_t i = 0; i < movedCount; ++i)
+		{
+			worker.deques[priority].push(queue.front().release());
+			queue.pop_front();
+		}
+	}
+
+	if(movedCount > 0 && m_parkedCount.load() > 0)
+		wakeWorker();
+
+	return task;
+}
+
+ThreadPool::TaskBase* ThreadPool::stealTask(Worker& worker, std::size_t priority)
+{
+	const auto slotCount = m_slotCount.load();
+
+	if(slotCount < 2)
+		return nullptr;
+
+	const auto start = nextRandom(worker.randomState) % slotCount;
+
+	for(unsigned int i = 0; i < slotCount; ++i)
+	{
+		auto& victim = m_workers[(start + i) % slotCount];
+
+		if(&victim == &worker)
+			continue;
+
+		if(auto* task = victim.deques[priority].steal())
+			return task;
+	}
+
+	return nullptr;
+}
+
+bool ThreadPool::hasQueuedTasks() const
+{
+	return std::any_of(m_queuedCounts.begin(), m_queuedCounts.end(), [](const QueuedCount& count)
+	{
+		return count.value.load() > 0;
 	});
 }
 
+void ThreadPool::wakeWorker()
+{
+	{
+		const auto lock = std::lock_guard(m_parkMutex);
+		m_wakeEpoch.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	m_parkEvent.notify_one();
+}
+
 } // namespace lsp
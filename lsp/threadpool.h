@@ -1,53 +1,380 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <mutex>
-#include <queue>
+#include <deque>
 #include <future>
 #include <thread>
 #include <vector>
 #include <memory>
+#include <new>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <ranges>
 #include <condition_variable>
+#include <lsp/affinity.h>
+#include <lsp/timerwheel.h>
 
 namespace lsp{
 
+/*
+ * Tasks with a higher priority are run first.
+ * Lower priority tasks that were passed over too often are run next so they can't starve.
+ */
+enum class TaskPriority{
+	High,
+	Normal,
+	Low
+};
+
+struct ThreadPoolOptions{
+	// Threads that are started right away and never exit because they are idle
+	unsigned int              minThreads  = 0;
+	unsigned int              maxThreads  = std::thread::hardware_concurrency();
+	// Threads above minThreads exit after they did not have anything to do for this long
+	std::chrono::milliseconds idleTimeout = std::chrono::seconds(30);
+	// Workers are pinned by their slot index, so a thread that replaces an exited one runs on the same CPU
+	CpuAffinity               affinity    = {};
+};
+
+/*
+ * Work stealing thread pool.
+ * Every worker has its own deques that tasks added from inside of a task are pushed to without locking.
+ * Tasks added from other threads go through a shared injection queue. Workers that run out of tasks
+ * take them from the injection queue or steal them from randomly chosen other workers before they are parked.
+ * Threads are only created once there are tasks for them.
+ */
 class ThreadPool{
 public:
+	struct Stats{
+		unsigned int threadCount;
+		unsigned int activeThreadCount; // Running or looking for a task
+		unsigned int idleThreadCount;   // Waiting for a task
+		std::size_t  queuedTaskCount;   // Not started yet
+	};
+
+	explicit ThreadPool(const ThreadPoolOptions& options);
 	ThreadPool(unsigned int initialThreads = 0, unsigned int maxThreads = std::thread::hardware_concurrency());
 	~ThreadPool();
 
+	// Runs all remaining tasks and joins the worker threads. The pool can be used again afterwards.
 	void waitUntilFinished();
 
+	/*
+	 * Shutdown without joining the workers.
+	 * drain returns a future that becomes ready once no task is queued or running. Tasks can still be added in the
+	 * meantime and have to finish as well. stop waits for the pool to drain until the deadline. After that, tasks
+	 * that have not started are destroyed without being run, including the ones that are added until stop returns.
+	 * Their futures throw std::future_error with broken_promise. A callable passed to post or addDelayedTask can have
+	 * a discard member function that is called instead of running it, e.g. to answer a request that will never be
+	 * processed. Exceptions thrown by discard are ignored. stop returns once the running tasks have finished and
+	 * reports how many were discarded. The workers stay alive so the pool can be used again right away.
+	 * Neither must be waited for from inside of a task.
+	 */
+	[[nodiscard]] std::future<void> drain();
+	std::size_t stop(std::chrono::steady_clock::time_point deadline);
+
+	// The counters are updated concurrently so they might not add up exactly
+	[[nodiscard]] Stats stats() const;
+
 	template<typename F, typename ...Args>
 	requires std::invocable<F, Args...>
 	auto addTask(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>
+	{
+		return addTask(TaskPriority::Normal, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	template<typename F, typename ...Args>
+	requires std::invocable<F, Args...>
+	auto addTask(TaskPriority priority, F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>
 	{
 		auto task   = std::make_unique<Task<F, Args...>>(std::forward<F>(f), std::forward<Args>(args)...);
 		auto future = task->promise.get_future();
-		addTask(std::move(task));
+		addTask(TaskPtr(task.release()), priority);
 		return future;
 	}
 
+	/*
+	 * Runs f without creating a future for the result.
+	 * Small callables are stored inside of recycled task objects instead of being allocated for every task.
+	 * Exceptions thrown by f are ignored.
+	 */
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	void post(F&& f)
+	{
+		post(TaskPriority::Normal, std::forward<F>(f));
+	}
+
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	void post(TaskPriority priority, F&& f)
+	{
+		addTask(PostedTask::create(std::forward<F>(f)), priority);
+	}
+
+	/*
+	 * Delayed and periodic tasks.
+	 * The tasks are posted to the pool once they are due. All timers of a pool share a single timer thread
+	 * that is started when the first one is scheduled. Timers that are not due yet are not affected by waitUntilFinished.
+	 */
+	using TimerId = TimerWheel::TimerId;
+
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	TimerId addDelayedTask(std::chrono::milliseconds delay, F&& f)
+	{
+		return addDelayedTask(delay, TaskPriority::Normal, std::forward<F>(f));
+	}
+
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	TimerId addDelayedTask(std::chrono::milliseconds delay, TaskPriority priority, F&& f)
+	{
+		return m_timers->schedule(delay, [this, priority, task = DelayedRun<std::decay_t<F>>(std::forward<F>(f))]() mutable
+		{
+			post(priority, std::move(task));
+		});
+	}
+
+	// The task is first run after one interval. A run is skipped if the previous one has not finished yet.
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	TimerId addPeriodicTask(std::chrono::milliseconds interval, F&& f)
+	{
+		return addPeriodicTask(interval, TaskPriority::Normal, std::forward<F>(f));
+	}
+
+	template<typename F>
+	requires std::invocable<std::decay_t<F>&>
+	TimerId addPeriodicTask(std::chrono::milliseconds interval, TaskPriority priority, F&& f)
+	{
+		auto task = std::make_shared<PeriodicTask<std::decay_t<F>>>(std::forward<F>(f));
+
+		return m_timers->schedulePeriodic(interval, [this, priority, task = std::move(task)]()
+		{
+			if(!task->running.exchange(true))
+				post(priority, PeriodicRun<std::decay_t<F>>(task));
+		});
+	}
+
+	// Returns false if the task was already posted or the timer was cancelled before.
+	// A periodic task that is running when it is cancelled is not interrupted.
+	bool cancelTimer(TimerId id);
+
+	/*
+	 * Fork-join loops.
+	 * The range is split into chunks of grain elements (chosen automatically if zero) that are run by the workers
+	 * and by the calling thread. They return once every chunk has finished. The calling thread never waits for a chunk
+	 * that has not started yet so they can be called from inside of a task, even if all workers are busy.
+	 * If f throws, the remaining chunks are skipped and the first exception is rethrown.
+	 */
+	template<typename Index, typename F>
+	requires std::integral<Index> && std::invocable<F&, Index>
+	void parallelFor(Index begin, Index end, std::size_t grain, F&& f)
+	{
+		if(end <= begin)
+			return;
+
+		struct Context{
+			Index       begin;
+			std::size_t count;
+			std::size_t chunkSize;
+			F&          f;
+		};
+
+		const auto count   = static_cast<std::size_t>(end - begin);
+		auto       context = Context{begin, count, grain > 0 ? grain : defaultGrain(count), f};
+
+		forkJoin((count + context.chunkSize - 1) / context.chunkSize, [](void* data, std::size_t chunk)
+		{
+			auto&      c     = *static_cast<Context*>(data);
+			const auto first = chunk * c.chunkSize;
+			const auto last  = std::min(first + c.chunkSize, c.count);
+
+			for(auto i = first; i < last; ++i)
+				std::invoke(c.f, static_cast<Index>(c.begin + static_cast<Index>(i)));
+		}, &context);
+	}
+
+	template<std::ranges::random_access_range R, typename F>
+	requires std::ranges::sized_range<R> && std::invocable<F&, std::ranges::range_reference_t<R>>
+	void parallelFor(R&& range, std::size_t grain, F&& f)
+	{
+		auto first = std::ranges::begin(range);
+		parallelFor(std::size_t(0), static_cast<std::size_t>(std::ranges::size(range)), grain, [&first, &f](std::size_t i)
+		{
+			std::invoke(f, first[static_cast<std::ranges::range_difference_t<R>>(i)]);
+		});
+	}
+
+	/*
+	 * Every chunk combines map(element) starting with identity. The chunk results are then combined in order,
+	 * so reduce has to be associative but does not have to be commutative.
+	 */
+	template<typename Index, typename T, typename Map, typename Reduce>
+	requires std::integral<Index> && std::invocable<Map&, Index> &&
+	         std::is_invocable_r_v<T, Reduce&, T&&, std::invoke_result_t<Map&, Index>> && std::is_invocable_r_v<T, Reduce&, T&&, T&&>
+	T parallelReduce(Index begin, Index end, std::size_t grain, T identity, Map&& map, Reduce&& reduce)
+	{
+		if(end <= begin)
+			return identity;
+
+		const auto count      = static_cast<std::size_t>(end - begin);
+		const auto chunkSize  = grain > 0 ? grain : defaultGrain(count);
+		const auto chunkCount = (count + chunkSize - 1) / chunkSize;
+		auto       partials   = std::vector<T>(chunkCount, identity);
+
+		parallelFor(std::size_t(0), chunkCount, 1, [&](std::size_t chunk)
+		{
+			const auto first = chunk * chunkSize;
+			const auto last  = std::min(first + chunkSize, count);
+			auto&      value = partials[chunk];
+
+			for(auto i = first; i < last; ++i)
+				value = std::invoke(reduce, std::move(value), std::invoke(map, static_cast<Index>(begin + static_cast<Index>(i))));
+		});
+
+		auto result = std::move(identity);
+
+		for(auto& partial : partials)
+			result = std::invoke(reduce, std::move(result), std::move(partial));
+
+		return result;
+	}
+
+	template<std::ranges::random_access_range R, typename T, typename Map, typename Reduce>
+	requires std::ranges::sized_range<R> && std::invocable<Map&, std::ranges::range_reference_t<R>>
+	T parallelReduce(R&& range, std::size_t grain, T identity, Map&& map, Reduce&& reduce)
+	{
+		auto first = std::ranges::begin(range);
+		return parallelReduce(std::size_t(0), static_cast<std::size_t>(std::ranges::size(range)), grain, std::move(identity), [&first, &map](std::size_t i)
+		{
+			return std::invoke(map, first[static_cast<std::ranges::range_difference_t<R>>(i)]);
+		}, reduce);
+	}
+
 private:
 	struct TaskBase;
-	using TaskPtr = std::unique_ptr<TaskBase>;
+	struct Worker;
+
+	struct TaskDeleter{
+		void operator()(TaskBase* task) const;
+	};
+
+	using TaskPtr = std::unique_ptr<TaskBase, TaskDeleter>;
+
+	static constexpr std::size_t  PriorityCount      = static_cast<std::size_t>(TaskPriority::Low) + 1;
+	// Number of times a task can be passed over by tasks with a higher priority before it is run
+	static constexpr unsigned int StarvationLimit    = 8;
+	// Maximum number of tasks a worker moves from the injection queue to its own deque at once
+	static constexpr std::size_t  InjectionBatchSize = 16;
+
+	/*
+	 * Chase-Lev deque.
+	 * The owning worker pushes and pops at the bottom without locking while other workers steal from the top.
+	 */
+	class TaskDeque{
+	public:
+		TaskDeque();
+		TaskDeque(const TaskDeque&) = delete;
+		TaskDeque& operator=(const TaskDeque&) = delete;
+		~TaskDeque();
+
+		void push(TaskBase* task);      // Owner only
+		[[nodiscard]] TaskBase* pop();  // Owner only
+		[[nodiscard]] TaskBase* steal();
+		// Replaces the buffer with one that is first touched by the calling thread so that it is allocated on its NUMA node
+		void moveToLocalMemory();       // Owner only
 
-	bool                     m_waitForNewTasks = false;
-	unsigned int             m_maxThreads      = std::thread::hardware_concurrency();
-	std::vector<std::thread> m_threads;
-	std::queue<TaskPtr>      m_taskQueue;
-	std::mutex               m_mutex;
-	std::condition_variable  m_event;
+	private:
+		struct Buffer{
+			explicit Buffer(std::int64_t capacity);
 
-	void addTask(TaskPtr task);
+			std::int64_t                              capacity;
+			std::unique_ptr<std::atomic<TaskBase*>[]> tasks;
+
+			TaskBase* get(std::int64_t index) const{ return tasks[static_cast<std::size_t>(index & (capacity - 1))].load(std::memory_order_relaxed); }
+			void put(std::int64_t index, TaskBase* task){ tasks[static_cast<std::size_t>(index & (capacity - 1))].store(task, std::memory_order_relaxed); }
+		};
+
+		alignas(64) std::atomic<std::int64_t> m_top    = 0;
+		alignas(64) std::atomic<std::int64_t> m_bottom = 0;
+		std::atomic<Buffer*>                  m_buffer;
+		// Buffers that were replaced are kept until destruction since thieves might still read from them
+		std::vector<std::unique_ptr<Buffer>>  m_buffers;
+
+		Buffer* replaceBuffer(std::int64_t capacity);
+	};
+
+	struct alignas(64) QueuedCount{
+		std::atomic<std::int64_t> value = 0;
+	};
+
+	// Workers
+	unsigned int                                   m_minThreads = 0;
+	unsigned int                                   m_maxThreads = std::thread::hardware_concurrency();
+	std::chrono::milliseconds                      m_idleTimeout;
+	CpuAffinity                                    m_affinity;
+	// Worker slots are reused when a thread exits. Slots up to m_slotCount might be in use.
+	std::unique_ptr<Worker[]>                      m_workers;
+	std::atomic<unsigned int>                      m_slotCount   = 0;
+	std::atomic<unsigned int>                      m_workerCount = 0;
+	std::vector<std::thread>                       m_threads; // Indexed by slot
+	std::vector<unsigned int>                      m_freeSlots;
+	std::mutex                                     m_threadsMutex;
+	// Tasks added from outside of the pool
+	std::array<std::deque<TaskPtr>, PriorityCount> m_injectedTasks;
+	std::mutex                                     m_injectionMutex;
+	// Number of tasks that have not been started yet per priority
+	std::array<QueuedCount, PriorityCount>         m_queuedCounts;
+	// Parking
+	std::atomic<unsigned int>                      m_parkedCount = 0;
+	std::atomic<std::uint64_t>                     m_wakeEpoch   = 0;
+	std::mutex                                     m_parkMutex;
+	std::condition_variable                        m_parkEvent;
+	// Shutdown
+	bool                                           m_acceptingTasks = true;
+	std::atomic<bool>                              m_stopping       = false;
+	std::mutex                                     m_stateMutex;
+	std::condition_variable                        m_stateEvent;
+	// Draining
+	alignas(64) std::atomic<std::int64_t>          m_pendingCount   = 0; // Queued or running
+	std::atomic<bool>                              m_discarding     = false;
+	std::atomic<std::size_t>                       m_discardedCount = 0;
+	std::vector<std::promise<void>>                m_drainPromises;
+	std::mutex                                     m_drainMutex;
+	std::mutex                                     m_stopMutex;
+	// Delayed and periodic tasks. Destroyed before the workers are stopped.
+	std::unique_ptr<TimerWheel>                    m_timers;
+
+	void addTask(TaskPtr task, TaskPriority priority);
+	void forkJoin(std::size_t chunkCount, void (*runChunk)(void* context, std::size_t chunk), void* context);
+	[[nodiscard]] std::size_t defaultGrain(std::size_t count) const;
 	void addThread();
+	void runWorker(unsigned int slot);
+	void finishTask();
+	[[nodiscard]] bool park(unsigned int slot);
+	[[nodiscard]] TaskPtr findTask(Worker& worker);
+	[[nodiscard]] TaskBase* takeInjectedTask(Worker& worker, std::size_t priority);
+	[[nodiscard]] TaskBase* stealTask(Worker& worker, std::size_t priority);
+	[[nodiscard]] bool hasQueuedTasks() const;
+	void wakeWorker();
 
 	struct TaskBase{
 		virtual ~TaskBase() = default;
 		virtual void execute() = 0;
+		virtual void discard(){} // Called instead of execute if the task is discarded by stop
+		virtual void destroy(){ delete this; }
 	};
 
+	template<typename F>
+	static constexpr bool HasDiscard = requires(F& f){ f.discard(); };
+
 	template<typename F, typename ...Args>
 	struct Task : TaskBase{
 		using ResultType = std::invoke_result_t<F, Args...>;
@@ -86,6 +413,105 @@ private:
 		}
 	};
 
+	class PostedTask final : public TaskBase{
+	public:
+		// Callables up to this size are stored inline
+		static constexpr std::size_t InlineSize = 128;
+
+		template<typename F>
+		static TaskPtr create(F&& f)
+		{
+			using Callable = std::decay_t<F>;
+
+			auto* task = new(allocate()) PostedTask;
+
+			try
+			{
+				if constexpr(sizeof(Callable) <= InlineSize && alignof(Callable) <= alignof(std::max_align_t))
+				{
+					new(task->m_storage) Callable(std::forward<F>(f));
+					task->m_invoke  = [](void* storage){ std::invoke(*std::launder(static_cast<Callable*>(storage))); };
+					task->m_destroy = [](void* storage){ std::launder(static_cast<Callable*>(storage))->~Callable(); };
+
+					if constexpr(HasDiscard<Callable>)
+						task->m_discard = [](void* storage){ std::launder(static_cast<Callable*>(storage))->discard(); };
+				}
+				else
+				{
+					new(task->m_storage) Callable*(new Callable(std::forward<F>(f)));
+					task->m_invoke  = [](void* storage){ std::invoke(**std::launder(static_cast<Callable**>(storage))); };
+					task->m_destroy = [](void* storage){ delete *std::launder(static_cast<Callable**>(storage)); };
+
+					if constexpr(HasDiscard<Callable>)
+						task->m_discard = [](void* storage){ (*std::launder(static_cast<Callable**>(storage)))->discard(); };
+				}
+			}
+			catch(...)
+			{
+				task->~PostedTask();
+				deallocate(task);
+				throw;
+			}
+
+			return TaskPtr(task);
+		}
+
+		void execute() override;
+		void discard() override;
+		void destroy() override;
+
+	private:
+		alignas(std::max_align_t) std::byte m_storage[InlineSize];
+		void (*m_invoke)(void*)  = nullptr;
+		void (*m_discard)(void*) = nullptr; // Null if the callable has no discard member function
+		void (*m_destroy)(void*) = nullptr;
+
+		PostedTask() = default;
+
+		// Task memory is recycled through thread local free lists
+		static void* allocate();
+		static void deallocate(void* memory);
+	};
+
+	// Posted once a delayed task is due. The callable is shared since the timer callback might be copied.
+	template<typename F>
+	struct DelayedRun{
+		std::shared_ptr<F> task;
+
+		explicit DelayedRun(F&& f) : task{std::make_shared<F>(std::move(f))}{}
+		explicit DelayedRun(const F& f) : task{std::make_shared<F>(f)}{}
+
+		void operator()(){ std::invoke(*task); }
+		void discard() requires HasDiscard<F>{ task->discard(); }
+	};
+
+	template<typename F>
+	struct PeriodicTask{
+		F                 callback;
+		std::atomic<bool> running = false;
+
+		explicit PeriodicTask(F&& f) : callback{std::move(f)}{}
+		explicit PeriodicTask(const F& f) : callback{f}{}
+	};
+
+	// Posted for every run of a periodic task. The next run is allowed once it is destroyed, even if it was discarded by stop.
+	template<typename F>
+	struct PeriodicRun{
+		std::shared_ptr<PeriodicTask<F>> task;
+
+		explicit PeriodicRun(std::shared_ptr<PeriodicTask<F>> task) : task{std::move(task)}{}
+		PeriodicRun(PeriodicRun&&) noexcept = default;
+		~PeriodicRun(){ if(task) task->running.store(false); }
+
+		void operator()(){ std::invoke(task->callback); }
+	};
+
+	struct Worker{
+		std::array<TaskDeque, PriorityCount>    deques;
+		std::array<unsigned int, PriorityCount> skippedCounts = {};
+		std::uint32_t                           randomState   = 0;
+		bool                                    localMemory   = false; // Deques were moved to the memory of the pinned CPU
+	};
 };
 
 } // namespace lsp
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <limits>
+#include <lsp/timerwheel.h>
+
+namespace lsp{
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tickInterval)
+	: m_tickInterval{std::max(tickInterval, std::chrono::milliseconds(1))}
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		m_running = false;
+	}
+
+	m_event.notify_all();
+
+	if(m_thread.joinable())
+		m_thread.join();
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::chrono::milliseconds delay, Callback callback)
+{
+	return addTimer(delay, std::chrono::milliseconds::zero(), std::move(callback));
+}
+
+TimerWheel::TimerId TimerWheel::schedulePeriodic(std::chrono::milliseconds interval, Callback callback)
+{
+	return addTimer(interval, std::max(interval, m_tickInterval), std::move(callback));
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+	std::shared_ptr<Callback> callback; // Destroyed after the lock is released
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		const auto it   = m_timers.find(id);
+
+		if(it == m_timers.end())
+			return false;
+
+		callback = std::move(it->second.callback);
+		m_timers.erase(it);
+	}
+
+	return true;
+}
+
+std::size_t TimerWheel::activeTimerCount() const
+{
+	const auto lock = std::lock_guard(m_mutex);
+	return m_timers.size();
+}
+
+std::uint64_t TimerWheel::tickAt(Clock::time_point time) const
+{
+	return static_cast<std::uint64_t>((time - m_startTime) / m_tickInterval);
+}
+
+std::uint64_t TimerWheel::ticksFor(std::chrono::milliseconds duration) const
+{
+	return static_cast<std::uint64_t>((duration + m_tickInterval - std::chrono::milliseconds(1)) / m_tickInterval);
+}
+
+TimerWheel::TimerId TimerWheel::addTimer(std::chrono::milliseconds delay, std::chrono::milliseconds interval, Callback&& callback)
+{
+	const auto expiryTime = Clock::now() + std::max(delay, std::chrono::milliseconds::zero());
+	// Round up so that timers never expire early
+	const auto expiryTick = tickAt(expiryTime + m_tickInterval - Clock::duration(1));
+
+	const auto lock = std::lock_guard(m_mutex);
+	const auto id   = m_nextTimerId++;
+
+	if(m_timers.empty())
+	{
+		// Nothing is in the slots so the wheel can skip the ticks it slept through
+		m_currentTick = std::max(m_currentTick, tickAt(Clock::now()));
+	}
+
+	const auto tick = std::max(expiryTick, m_currentTick + 1);
+
+	m_timers.emplace(id, Timer{tick, ticksFor(interval), std::make_shared<Callback>(std::move(callback))});
+	insert(id, tick);
+
+	if(!m_running)
+	{
+		m_running = true;
+		m_thread  = std::thread(&TimerWheel::run, this);
+	}
+	else
+	{
+		m_event.notify_one();
+	}
+
+	return id;
+}
+
+void TimerWheel::insert(TimerId id, std::uint64_t expiryTick)
+{
+	// Must be called with m_mutex locked
+	constexpr auto MaxDelta = (std::uint64_t(1) << (SlotBits * LevelCount)) - 1;
+
+	// Timers that are further away than the top level can hold are moved down again once their slot is reached
+	const auto delta = std::clamp(expiryTick - std::min(expiryTick, m_currentTick), std::uint64_t(0), MaxDelta);
+	const auto level = delta == 0 ? 0u : static_cast<unsigned int>(std::bit_width(delta) - 1) / SlotBits;
+	const auto slot  = ((m_currentTick + delta) >> (level * SlotBits)) & (SlotCount - 1);
+
+	m_levels[level].slots[slot].push_back(id);
+	m_levels[level].occupiedSlots |= std::uint64_t(1) << slot;
+}
+
+std::uint64_t TimerWheel::nextEventTick() const
+{
+	// Must be called with m_mutex locked
+	auto next = std::numeric_limits<std::uint64_t>::max();
+
+	for(unsigned int level = 0; level < LevelCount; ++level)
+	{
+		const auto occupied = m_levels[level].occupiedSlots;
+
+		if(occupied == 0)
+			continue;
+
+		// The slots of a level are reached one after another starting after the current one
+		const auto shift        = level * SlotBits;
+		const auto base         = m_currentTick >> shift;
+		const auto currentSlot  = static_cast<int>(base & (SlotCount - 1));
+		const auto rotated      = std::rotr(occupied, currentSlot + 1);
+		const auto distance     = static_cast<std::uint64_t>(std::countr_zero(rotated)) + 1;
+
+		next = std::min(next, (base + distance) << shift);
+	}
+
+	return next;
+}
+
+void TimerWheel::run()
+{
+	auto callbacks = std::vector<std::shared_ptr<Callback>>();
+	auto lock      = std::unique_lock(m_mutex);
+
+	while(m_running)
+	{
+		if(m_timers.empty())
+			m_event.wait(lock);
+		else
+			m_event.wait_until(lock, m_startTime + nextEventTick() * m_tickInterval);
+
+		advance(tickAt(Clock::now()), callbacks);
+
+		if(callbacks.empty())
+			continue;
+
+		lock.unlock();
+
+		for(const auto& callback : callbacks)
+			(*callback)();
+
+		callbacks.clear();
+		lock.lock();
+	}
+}
+
+void TimerWheel::advance(std::uint64_t targetTick, std::vector<std::shared_ptr<Callback>>& callbacks)
+{
+	// Must be called with m_mutex locked
+	// Only the ticks at which a slot with timers is reached have to be visited
+	while(m_currentTick < targetTick)
+	{
+		const auto next = nextEventTick();
+
+		if(next > targetTick)
+		{
+			m_currentTick = targetTick;
+			break;
+		}
+
+		m_currentTick = next;
+		processTick(callbacks);
+	}
+}
+
+void TimerWheel::processTick(std::vector<std::shared_ptr<Callback>>& callbacks)
+{
+	// Must be called with m_mutex locked
+	// Higher levels first since their timers might move to the slot of the current tick on a lower level
+	for(auto level = LevelCount; level-- > 0;)
+	{
+		const auto shift = level * SlotBits;
+
+		if(level > 0 && (m_currentTick & ((std::uint64_t(1) << shift) - 1)) != 0)
+			continue;
+
+		const auto slot  = (m_currentTick >> shift) & (SlotCount - 1);
+		auto&      state = m_levels[level];
+
+		if((state.occupiedSlots & (std::uint64_t(1) << slot)) == 0)
+			continue;
+
+		auto ids = std::move(state.slots[slot]);
+		state.slots[slot].clear();
+		state.occupiedSlots &= ~(std::uint64_t(1) << slot);
+
+		for(const auto id : ids)
+		{
+			const auto it = m_timers.find(id);
+
+			if(it == m_timers.end()) // Cancelled
+				continue;
+
+			auto& timer = it->second;
+
+			if(timer.expiryTick > m_currentTick)
+			{
+				insert(id, timer.expiryTick);
+				continue;
+			}
+
+			if(timer.intervalTicks == 0)
+			{
+				callbacks.push_back(std::move(timer.callback));
+				m_timers.erase(it);
+				continue;
+			}
+
+			// Periodic timers keep their schedule unless the wheel fell behind by more than an interval
+			callbacks.push_back(timer.callback);
+			timer.expiryTick = std::max(timer.expiryTick + timer.intervalTicks, m_currentTick + 1);
+			insert(id, timer.expiryTick);
+		}
+	}
+}
+
+} // namespace lsp
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lsp{
+
+/*
+ * Hierarchical timer wheel.
+ * Every level has 64 slots and each slot of a level covers 64 times as many ticks as one of the level below.
+ * Timers are put into the lowest level that can hold their delay and move down a level whenever the wheel reaches
+ * their slot, so scheduling and cancelling don't depend on the number of active timers. Timers expire with a
+ * precision of one tick.
+ * Callbacks are run on a thread owned by the wheel that is started once the first timer is scheduled. The thread
+ * only wakes up when a slot with timers is reached. Callbacks must not block since they delay all other timers.
+ */
+class TimerWheel{
+public:
+	using TimerId  = std::uint64_t;
+	using Callback = std::function<void()>;
+
+	static constexpr TimerId InvalidTimerId = 0;
+
+	explicit TimerWheel(std::chrono::milliseconds tickInterval = std::chrono::milliseconds(100));
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+	~TimerWheel();
+
+	TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+	// The callback is first called after one interval. Periodic timers stay active until they are cancelled.
+	TimerId schedulePeriodic(std::chrono::milliseconds interval, Callback callback);
+	// Returns false if the timer already expired or was cancelled before
+	bool cancel(TimerId id);
+	[[nodiscard]] std::size_t activeTimerCount() const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr unsigned int  SlotBits   = 6;
+	static constexpr std::uint64_t SlotCount  = std::uint64_t(1) << SlotBits;
+	static constexpr unsigned int  LevelCount = 6;
+
+	struct Timer{
+		std::uint64_t             expiryTick;
+		std::uint64_t             intervalTicks; // Zero for timers that only expire once
+		std::shared_ptr<Callback> callback;
+	};
+
+	struct Level{
+		std::array<std::vector<TimerId>, SlotCount> slots;
+		std::uint64_t                               occupiedSlots = 0; // Bit mask. Slots can contain cancelled timers.
+	};
+
+	const std::chrono::milliseconds          m_tickInterval;
+	const Clock::time_point                  m_startTime = Clock::now();
+	std::array<Level, LevelCount>            m_levels;
+	std::unordered_map<TimerId, Timer>       m_timers; // Cancelled timers are only removed from the slots once they are reached
+	std::uint64_t                            m_currentTick = 0;
+	TimerId                                  m_nextTimerId = InvalidTimerId + 1;
+	bool                                     m_running     = false;
+	mutable std::mutex                       m_mutex;
+	std::condition_variable                  m_event;
+	std::thread                              m_thread;
+
+	[[nodiscard]] std::uint64_t tickAt(Clock::time_point time) const;
+	[[nodiscard]] std::uint64_t ticksFor(std::chrono::milliseconds duration) const;
+	TimerId addTimer(std::chrono::milliseconds delay, std::chrono::milliseconds interval, Callback&& callback);
+	void insert(TimerId id, std::uint64_t expiryTick);
+	[[nodiscard]] std::uint64_t nextEventTick() const;
+	void run();
+	void advance(std::uint64_t targetTick, std::vector<std::shared_ptr<Callback>>& callbacks);
+	void processTick(std::vector<std::shared_ptr<Callback>>& callbacks);
+};
+
+} // namespace lsp
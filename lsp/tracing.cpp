@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <lsp/json/json.h>
+#include <lsp/process.h>
+#include <lsp/tracing.h>
+
+namespace lsp{
+
+/*
+ * Tracer
+ */
+
+struct Tracer::Span{
+	enum class IdKind : std::uint8_t{
+		None,
+		Null,
+		Integer,
+		String
+	};
+
+	const char*          name;
+	Clock::time_point    start;
+	Clock::time_point    end;
+	std::int32_t         idInteger;
+	IdKind               idKind;
+	std::uint8_t         methodSize;
+	std::uint8_t         idStringSize;
+	std::array<char, 64> method; // Longer methods and string ids are truncated
+	std::array<char, 32> idString;
+};
+
+/*
+ * Ring buffer that is only written to by its thread and only read by the flushing thread
+ */
+class Tracer::ThreadBuffer{
+public:
+	static constexpr std::size_t Capacity = 1024;
+
+	explicit ThreadBuffer(std::uint32_t threadId)
+		: m_threadId{threadId}
+	{
+	}
+
+	[[nodiscard]] std::uint32_t threadId() const{ return m_threadId; }
+	[[nodiscard]] std::uint64_t droppedCount() const{ return m_dropped.load(std::memory_order_relaxed); }
+
+	Span* beginWrite()
+	{
+		const auto tail = m_tail.load(std::memory_order_relaxed);
+
+		if(tail - m_head.load(std::memory_order_acquire) == Capacity)
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		return &m_spans[tail % Capacity];
+	}
+
+	void endWrite()
+	{
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	template<typename F>
+	void drain(F&& f)
+	{
+		const auto head = m_head.load(std::memory_order_relaxed);
+		const auto tail = m_tail.load(std::memory_order_acquire);
+
+		for(auto i = head; i != tail; ++i)
+			f(m_spans[i % Capacity]);
+
+		m_head.store(tail, std::memory_order_release);
+	}
+
+private:
+	alignas(64) std::atomic<std::size_t> m_head    = 0;
+	alignas(64) std::atomic<std::size_t> m_tail    = 0;
+	std::atomic<std::uint64_t>           m_dropped = 0;
+	const std::uint32_t                  m_threadId;
+	std::array<Span, Capacity>           m_spans;
+};
+
+namespace{
+
+struct ThreadBufferRef{
+	std::uint64_t         generation = 0;
+	std::shared_ptr<void> buffer; // Tracer::ThreadBuffer
+};
+
+thread_local ThreadBufferRef t_threadBuffer;
+thread_local std::string_view t_scopeMethod;
+thread_local const jsonrpc::MessageId* t_scopeId = nullptr;
+
+template<std::size_t N>
+std::uint8_t copyTruncated(std::array<char, N>& dst, std::string_view src)
+{
+	static_assert(N <= 255);
+	const auto size = std::min(src.size(), N);
+	std::memcpy(dst.data(), src.data(), size);
+	return static_cast<std::uint8_t>(size);
+}
+
+} // namespace
+
+std::atomic<std::uint64_t> Tracer::s_generation = 0;
+Tracer*                    Tracer::s_tracer     = nullptr;
+std::mutex                 Tracer::s_tracerMutex;
+
+Tracer::Tracer(const std::string& path, std::chrono::milliseconds flushInterval)
+	: m_flushInterval{flushInterval}
+{
+	const auto lock = std::lock_guard(s_tracerMutex);
+
+	if(s_tracer)
+		throw TraceError("There already is an active tracer");
+
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+
+	if(!m_file)
+		throw TraceError("Failed to open trace file '" + path + '\'');
+
+	m_file << "[\n";
+	m_thread = std::thread([this](){ run(); });
+
+	static std::uint64_t generation = 0;
+	s_tracer = this;
+	s_generation.store(++generation, std::memory_order_release);
+}
+
+Tracer::~Tracer()
+{
+	{
+		const auto lock = std::lock_guard(s_tracerMutex);
+		s_tracer = nullptr;
+		s_generation.store(0, std::memory_order_release);
+	}
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		m_running = false;
+	}
+
+	m_event.notify_one();
+	m_thread.join();
+	flush();
+	m_file << "\n]\n";
+}
+
+std::uint64_t Tracer::droppedSpanCount() const
+{
+	const auto lock = std::lock_guard(m_mutex);
+	auto count = m_droppedSpanCount;
+
+	for(const auto& buffer : m_buffers)
+		count += buffer->droppedCount();
+
+	return count;
+}
+
+void Tracer::record(const char* name, Clock::time_point start, Clock::time_point end, std::string_view method, const jsonrpc::MessageId* id)
+{
+	const auto generation = s_generation.load(std::memory_order_acquire);
+
+	if(generation == 0)
+		return;
+
+	auto* buffer = threadBuffer(generation);
+
+	if(!buffer)
+		return;
+
+	auto* span = buffer->beginWrite();
+
+	if(!span)
+		return;
+
+	if(method.empty())
+		method = t_scopeMethod;
+
+	if(!id)
+		id = t_scopeId;
+
+	span->name       = name;
+	span->start      = start;
+	span->end        = end;
+	span->methodSize = copyTruncated(span->method, method);
+	span->idKind     = Span::IdKind::None;
+
+	if(id)
+	{
+		if(std::holds_alternative<json::Integer>(*id))
+		{
+			span->idKind    = Span::IdKind::Integer;
+			span->idInteger = std::get<json::Integer>(*id);
+		}
+		else if(std::holds_alternative<json::String>(*id))
+		{
+			span->idKind       = Span::IdKind::String;
+			span->idStringSize = copyTruncated(span->idString, std::get<json::String>(*id));
+		}
+		else
+		{
+			span->idKind = Span::IdKind::Null;
+		}
+	}
+
+	buffer->endWrite();
+}
+
+Tracer::ThreadBuffer* Tracer::threadBuffer(std::uint64_t generation)
+{
+	if(t_threadBuffer.generation == generation)
+		return static_cast<ThreadBuffer*>(t_threadBuffer.buffer.get());
+
+	const auto lock = std::lock_guard(s_tracerMutex);
+
+	if(!s_tracer || s_generation.load(std::memory_order_relaxed) != generation)
+		return nullptr;
+
+	const auto tracerLock = std::lock_guard(s_tracer->m_mutex);
+	auto buffer = std::make_shared<ThreadBuffer>(s_tracer->m_nextThreadId++);
+	s_tracer->m_buffers.push_back(buffer);
+	t_threadBuffer.generation = generation;
+	t_threadBuffer.buffer = std::move(buffer);
+
+	return static_cast<ThreadBuffer*>(t_threadBuffer.buffer.get());
+}
+
+void Tracer::run()
+{
+	auto lock = std::unique_lock(m_mutex);
+
+	while(m_running)
+	{
+		m_event.wait_for(lock, m_flushInterval, [this](){ return !m_running; });
+		lock.unlock();
+		flush();
+		lock.lock();
+	}
+}
+
+void Tracer::flush()
+{
+	auto buffers = std::vector<ThreadBufferPtr>();
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+		buffers = m_buffers;
+	}
+
+	for(const auto& buffer : buffers)
+	{
+		const auto threadId = buffer->threadId();
+		buffer->drain([this, threadId](const Span& span){ writeSpan(span, threadId); });
+	}
+
+	// Buffers that are only referenced by the tracer belong to threads that have exited and won't receive new spans.
+	// The copies made above have to be released before checking.
+	buffers.clear();
+
+	{
+		const auto lock = std::lock_guard(m_mutex);
+
+		std::erase_if(m_buffers, [this](const ThreadBufferPtr& buffer){
+			if(buffer.use_count() > 1)
+				return false;
+
+			const auto threadId = buffer->threadId();
+			buffer->drain([this, threadId](const Span& span){ writeSpan(span, threadId); });
+			m_droppedSpanCount += buffer->droppedCount();
+
+			return true;
+		});
+	}
+
+	m_file.flush();
+}
+
+void Tracer::writeSpan(const Span& span, std::uint32_t threadId)
+{
+	const auto microseconds = [](Clock::duration duration){
+		return static_cast<json::Decimal>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()) / 1000.0;
+	};
+
+	json::Object event;
+	event["name"] = json::String(span.name);
+	event["cat"]  = json::String("lsp");
+	event["ph"]   = json::String("X");
+	event["ts"]   = microseconds(span.start - m_startTime);
+	event["dur"]  = microseconds(span.end - span.start);
+#ifndef LSP_PROCESS_UNSUPPORTED
+	event["pid"]  = static_cast<json::Integer>(Process::currentProcessId());
+#else
+	event["pid"]  = json::Integer(0);
+#endif
+	event["tid"]  = static_cast<json::Integer>(threadId);
+
+	json::Object args;
+
+	if(span.methodSize > 0)
+		args["method"] = json::String(span.method.data(), span.methodSize);
+
+	switch(span.idKind)
+	{
+	case Span::IdKind::None:
+		break;
+	case Span::IdKind::Null:
+		args["id"] = nullptr;
+		break;
+	case Span::IdKind::Integer:
+		args["id"] = span.idInteger;
+		break;
+	case Span::IdKind::String:
+		args["id"] = json::String(span.idString.data(), span.idStringSize);
+		break;
+	}
+
+	if(args.size() > 0)
+		event["args"] = std::move(args);
+
+	if(!m_firstSpan)
+		m_file << ",\n";
+
+	m_firstSpan = false;
+	m_file << json::stringify(json::Value(std::move(event)));
+}
+
+/*
+ * TraceContext
+ */
+
+TraceContext TraceContext::current()
+{
+	auto context = TraceContext();
+
+	if(Tracer::isEnabled())
+	{
+		context.m_method = t_scopeMethod;
+
+		if(t_scopeId)
+			context.m_id = *t_scopeId;
+	}
+
+	return context;
+}
+
+/*
+ * TraceScope
+ */
+
+TraceScope::TraceScope(std::string_view method, const jsonrpc::MessageId* id)
+	: m_previousMethod{t_scopeMethod}
+	, m_previousId{t_scopeId}
+{
+	t_scopeMethod = method;
+	t_scopeId     = id;
+}
+
+TraceScope::TraceScope(const TraceContext& context)
+	: TraceScope(context.m_method, context.m_id.has_value() ? &*context.m_id : nullptr)
+{
+}
+
+TraceScope::~TraceScope()
+{
+	t_scopeMethod = m_previousMethod;
+	t_scopeId     = m_previousId;
+}
+
+std::string_view TraceScope::currentMethod()
+{
+	return t_scopeMethod;
+}
+
+const jsonrpc::MessageId* TraceScope::currentId()
+{
+	return t_scopeId;
+}
+
+} // namespace lsp
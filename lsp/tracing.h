@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <lsp/exception.h>
+#include <lsp/jsonrpc/jsonrpc.h>
+
+namespace lsp{
+
+/*
+ * Exception thrown when a trace file can't be written
+ */
+class TraceError : public Exception{
+public:
+	using Exception::Exception;
+};
+
+/*
+ * Writes a span for every phase of the messages that are processed while it exists to a file in the
+ * Chrome trace_event format that can be opened with chrome://tracing or Perfetto.
+ * Spans are recorded into a buffer owned by the thread that records them without locking and written to
+ * the file by a background thread. Spans are dropped if a thread records them faster than they are written.
+ * Only one tracer can exist at a time. While there is none, recording a span only checks an atomic flag.
+ */
+class Tracer{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit Tracer(const std::string& path, std::chrono::milliseconds flushInterval = std::chrono::milliseconds(100));
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+	~Tracer();
+
+	[[nodiscard]] static bool isEnabled(){ return s_generation.load(std::memory_order_relaxed) != 0; }
+
+	// Spans that were lost because the buffer of their thread was full
+	[[nodiscard]] std::uint64_t droppedSpanCount() const;
+
+	// The name must outlive the tracer, e.g. a string literal.
+	// Spans without a method or id are tagged with the ones of the current TraceScope.
+	static void record(const char* name, Clock::time_point start, Clock::time_point end,
+	                   std::string_view method = {}, const jsonrpc::MessageId* id = nullptr);
+
+private:
+	struct Span;
+	class ThreadBuffer;
+	using ThreadBufferPtr = std::shared_ptr<ThreadBuffer>;
+
+	static std::atomic<std::uint64_t> s_generation; // Zero while there is no tracer
+	static Tracer*                    s_tracer;
+	static std::mutex                 s_tracerMutex; // Protects s_tracer and registering threads
+
+	const Clock::time_point         m_startTime = Clock::now();
+	const std::chrono::milliseconds m_flushInterval;
+	std::ofstream                   m_file;
+	bool                            m_firstSpan = true;
+	// Buffers of the threads that recorded spans. Protected by m_mutex like the members below.
+	std::vector<ThreadBufferPtr>    m_buffers;
+	std::uint32_t                   m_nextThreadId = 1;
+	std::uint64_t                   m_droppedSpanCount = 0; // Of threads that have exited
+	mutable std::mutex              m_mutex;
+	std::condition_variable         m_event;
+	bool                            m_running = true;
+	std::thread                     m_thread;
+
+	static ThreadBuffer* threadBuffer(std::uint64_t generation);
+	void run();
+	void flush();
+	void writeSpan(const Span& span, std::uint32_t threadId);
+};
+
+/*
+ * Copy of the tags of the current TraceScope for work that continues on another thread
+ */
+class TraceContext{
+public:
+	// Empty while tracing is disabled
+	[[nodiscard]] static TraceContext current();
+
+private:
+	friend class TraceScope;
+
+	std::string                       m_method;
+	std::optional<jsonrpc::MessageId> m_id;
+};
+
+/*
+ * Sets the method and id that spans recorded on the current thread are tagged with while it exists
+ */
+class TraceScope{
+public:
+	TraceScope(std::string_view method, const jsonrpc::MessageId* id);
+	explicit TraceScope(const TraceContext& context);
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+	~TraceScope();
+
+	[[nodiscard]] static std::string_view currentMethod();
+	[[nodiscard]] static const jsonrpc::MessageId* currentId();
+
+private:
+	std::string_view          m_previousMethod;
+	const jsonrpc::MessageId* m_previousId;
+};
+
+/*
+ * Records a span from its construction until it is destroyed
+ */
+class TraceSpan{
+public:
+	explicit TraceSpan(const char* name)
+		: m_name{name}
+	{
+		if(Tracer::isEnabled())
+			m_start = Tracer::Clock::now();
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan()
+	{
+		if(m_start != Tracer::Clock::time_point())
+			Tracer::record(m_name, m_start, Tracer::Clock::now());
+	}
+
+private:
+	const char*               m_name;
+	Tracer::Clock::time_point m_start; // Default if tracing was disabled
+};
+
+} // namespace lsp
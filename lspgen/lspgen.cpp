@@ -978,6 +978,7 @@ R"(#pragma once
  *#############################################################*/
 
 #include <lsp/messagebase.h>
+#include "methods.h"
 #include "types.h"
 
 namespace lsp{
@@ -988,6 +989,24 @@ static constexpr const char* MessagesHeaderEnd =
 R"(} // namespace lsp
 )";
 
+static constexpr const char* MethodsHeaderBegin =
+R"(#pragma once
+
+/*#############################################################
+ * NOTE: This is a generated file and it shouldn't be modified!
+ *#############################################################*/
+
+#include <cstddef>
+#include <string_view>
+
+namespace lsp::message{
+
+)";
+
+static constexpr const char* MethodsHeaderEnd =
+R"(} // namespace lsp::message
+)";
+
 class CppGenerator
 {
 public:
@@ -997,6 +1016,7 @@ public:
 	{
 		generateTypes();
 		generateMessages();
+		generateMethods();
 	}
 
 	void writeFiles()
@@ -1004,6 +1024,7 @@ public:
 		writeFile("types.h", replaceString(TypesHeaderBegin, "${LSP_VERSION}", m_metaModel.metaData().version) + m_typesHeaderFileContent + m_typesBoilerPlateHeaderFileContent + TypesHeaderEnd);
 		writeFile("types.cpp", TypesSourceBegin + m_typesSourceFileContent + m_typesBoilerPlateSourceFileContent + TypesSourceEnd);
 		writeFile("messages.h", MessagesHeaderBegin + m_messagesHeaderFileContent + MessagesHeaderEnd);
+		writeFile("methods.h", MethodsHeaderBegin + m_methodsHeaderFileContent + MethodsHeaderEnd);
 	}
 
 private:
@@ -1012,6 +1033,7 @@ private:
 	std::string                                  m_typesBoilerPlateSourceFileContent;
 	std::string                                  m_typesSourceFileContent;
 	std::string                                  m_messagesHeaderFileContent;
+	std::string                                  m_methodsHeaderFileContent;
 	const MetaModel&                             m_metaModel;
 	std::unordered_set<std::string_view>         m_processedTypes;
 	std::unordered_set<std::string_view>         m_typesBeingProcessed;
@@ -1114,6 +1136,112 @@ private:
 		m_messagesHeaderFileContent += "};\n\n";
 	}
 
+	/*
+	 * Method lookup
+	 * methodIndex is generated as nested switch statements on the length of the method and the characters
+	 * that distinguish it from other methods of the same length. A single string comparison is needed
+	 * to verify the method once a candidate was found.
+	 */
+
+	using IndexedMethod = std::pair<std::string_view, std::size_t>;
+
+	void generateMethods()
+	{
+		auto methods = std::vector<IndexedMethod>();
+
+		for(const auto type : {MetaModel::MessageType::Request, MetaModel::MessageType::Notification})
+		{
+			for(const auto& [method, message] : m_metaModel.messagesByName(type))
+				methods.emplace_back(method, methods.size());
+		}
+
+		m_methodsHeaderFileContent += "inline constexpr std::size_t MethodCount = " + std::to_string(methods.size()) + ";\n\n"
+		                              "// Methods defined by the protocol ordered by their index\n"
+		                              "inline constexpr std::string_view Methods[MethodCount] = {\n";
+
+		for(const auto& [method, index] : methods)
+			m_methodsHeaderFileContent += "\t\"" + std::string(method) + "\",\n";
+
+		m_methodsHeaderFileContent += "};\n\n"
+		                              "// Returns the index of a method defined by the protocol or MethodCount if the method is unknown\n"
+		                              "constexpr std::size_t methodIndex(std::string_view method)\n"
+		                              "{\n"
+		                              "\tswitch(method.size())\n"
+		                              "\t{\n";
+
+		auto methodsByLength = std::map<std::size_t, std::vector<IndexedMethod>>();
+
+		for(const auto& method : methods)
+			methodsByLength[method.first.size()].push_back(method);
+
+		for(const auto& [length, group] : methodsByLength)
+		{
+			m_methodsHeaderFileContent += "\tcase " + std::to_string(length) + ":\n";
+			generateMethodSwitch(group, "\t\t");
+		}
+
+		m_methodsHeaderFileContent += "\t}\n\n"
+		                              "\treturn MethodCount;\n"
+		                              "}\n\n";
+
+		m_methodsHeaderFileContent += "static_assert([]()\n"
+		                              "{\n"
+		                              "\tfor(std::size_t i = 0; i < MethodCount; ++i)\n"
+		                              "\t{\n"
+		                              "\t\tif(methodIndex(Methods[i]) != i)\n"
+		                              "\t\t\treturn false;\n"
+		                              "\t}\n\n"
+		                              "\treturn methodIndex(\"$/unknown\") == MethodCount;\n"
+		                              "}());\n\n";
+	}
+
+	void generateMethodSwitch(const std::vector<IndexedMethod>& methods, const std::string& indent)
+	{
+		if(methods.size() == 1)
+		{
+			const auto& [method, index] = methods.front();
+			m_methodsHeaderFileContent += indent + "return method == \"" + std::string(method) + "\" ? " + std::to_string(index) + " : MethodCount;\n";
+			return;
+		}
+
+		// All methods have the same length so there always is a position with at least two different characters
+		auto position      = std::size_t(0);
+		auto distinctCount = std::size_t(0);
+
+		for(std::size_t i = 0; i < methods.front().first.size(); ++i)
+		{
+			auto chars = std::unordered_set<char>();
+
+			for(const auto& [method, index] : methods)
+				chars.insert(method[i]);
+
+			if(chars.size() > distinctCount)
+			{
+				position      = i;
+				distinctCount = chars.size();
+			}
+		}
+
+		auto methodsByChar = std::map<char, std::vector<IndexedMethod>>();
+
+		for(const auto& method : methods)
+			methodsByChar[method.first[position]].push_back(method);
+
+		m_methodsHeaderFileContent += indent + "switch(method[" + std::to_string(position) + "])\n" +
+		                              indent + "{\n";
+
+		for(const auto& [c, group] : methodsByChar)
+		{
+			const auto escape = (c == '\'' || c == '\\') ? "\\" : "";
+			m_methodsHeaderFileContent += indent + "case '" + escape + c + "':\n";
+			generateMethodSwitch(group, indent + '\t');
+		}
+
+		m_methodsHeaderFileContent += indent + "default:\n" +
+		                              indent + "\treturn MethodCount;\n" +
+		                              indent + "}\n";
+	}
+
 	static void writeFile(const std::string& name, std::string_view content)
 	{
 		std::ofstream file{name, std::ios::trunc | std::ios::binary};
@@ -0,0 +1,189 @@
+#include <lsp/io/eventloop.h>
+
+#ifndef LSP_EVENTLOOP_UNSUPPORTED
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <lsp/connection.h>
+#include <lsp/messagehandler.h>
+#include <lsp/io/socket.h>
+#include "test.h"
+
+using namespace std::chrono_literals;
+
+namespace{
+
+/*
+ * Serves one end of a socketpair with an event loop and talks to it through the other end
+ */
+class LoopFixture{
+public:
+	LoopFixture()
+	{
+		int fds[2];
+		LSP_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+		m_loop.addSocket(lsp::io::Socket::fromNativeHandle(fds[0]), [this](lsp::MessageHandler& messageHandler)
+		{
+			messageHandler.add("echo", lsp::MessageHandler::GenericMessageCallback([](lsp::json::Value&& params)
+			{
+				return std::move(params);
+			}));
+
+			messageHandler.add("asyncEcho", lsp::MessageHandler::GenericAsyncMessageCallback([](lsp::json::Value&& params)
+			{
+				return std::async(std::launch::deferred, [params = std::move(params)]() mutable { return std::move(params); });
+			}));
+
+			messageHandler.add("count", lsp::MessageHandler::GenericMessageCallback([this](lsp::json::Value&&)
+			{
+				++m_notificationCount;
+				return lsp::json::Value();
+			}));
+		});
+
+		m_client = std::make_unique<lsp::io::Socket>(lsp::io::Socket::fromNativeHandle(fds[1]));
+		m_thread = std::thread([this](){ m_loop.run(); });
+	}
+
+	~LoopFixture()
+	{
+		m_loop.stop();
+		m_thread.join();
+	}
+
+	lsp::io::EventLoop& loop(){ return m_loop; }
+	lsp::io::Socket& client(){ return *m_client; }
+	int notificationCount() const{ return m_notificationCount; }
+
+private:
+	lsp::io::EventLoop               m_loop{2};
+	std::atomic<int>                 m_notificationCount = 0;
+	std::unique_ptr<lsp::io::Socket> m_client;
+	std::thread                      m_thread;
+};
+
+bool waitFor(const auto& condition)
+{
+	const auto deadline = std::chrono::steady_clock::now() + 5s;
+
+	while(!condition())
+	{
+		if(std::chrono::steady_clock::now() > deadline)
+			return false;
+
+		std::this_thread::sleep_for(1ms);
+	}
+
+	return true;
+}
+
+/*
+ * Requests of different sizes are answered through the loop. Large ones need several reads and writes.
+ */
+void testRoundTrip()
+{
+	auto fixture    = LoopFixture();
+	auto connection = lsp::Connection(fixture.client());
+	auto handler    = lsp::MessageHandler(connection);
+	auto responses  = std::vector<lsp::FutureResponse<lsp::MessageHandler::GenericMessage>>();
+
+	LSP_CHECK(fixture.loop().sessionCount() == 1);
+
+	for(std::size_t i = 0; i < 20; ++i)
+	{
+		auto params = lsp::json::Array();
+		params.push_back(lsp::json::String(i * 4000, 'x'));
+		responses.push_back(handler.sendRequest(i % 2 == 0 ? "echo" : "asyncEcho", lsp::json::Value(std::move(params))));
+	}
+
+	for(std::size_t i = 0; i < responses.size(); ++i)
+		handler.processIncomingMessages();
+
+	for(std::size_t i = 0; i < responses.size(); ++i)
+	{
+		auto result = responses[i].result.get();
+		LSP_CHECK(result.isArray());
+		LSP_CHECK(result.array()[0].string().size() == i * 4000);
+	}
+}
+
+/*
+ * Shutting down the write side only ends the input. The responses that don't fit into the socket buffer
+ * are still sent before the session is closed.
+ */
+void testHalfClose()
+{
+	auto fixture    = LoopFixture();
+	auto connection = lsp::Connection(fixture.client());
+	auto handler    = lsp::MessageHandler(connection);
+	auto responses  = std::vector<lsp::FutureResponse<lsp::MessageHandler::GenericMessage>>();
+
+	for(std::size_t i = 0; i < 20; ++i)
+	{
+		auto params = lsp::json::Array();
+		params.push_back(lsp::json::String(i * 4000, 'x'));
+		responses.push_back(handler.sendRequest(i % 2 == 0 ? "echo" : "asyncEcho", lsp::json::Value(std::move(params))));
+	}
+
+	LSP_CHECK(shutdown(fixture.client().nativeHandle(), SHUT_WR) == 0);
+
+	for(std::size_t i = 0; i < responses.size(); ++i)
+		handler.processIncomingMessages();
+
+	for(std::size_t i = 0; i < responses.size(); ++i)
+		LSP_CHECK(responses[i].result.get().array()[0].string().size() == i * 4000);
+
+	LSP_CHECK(waitFor([&](){ return fixture.loop().sessionCount() == 0; }));
+}
+
+/*
+ * Messages that were sent right before the peer closed its end are still processed
+ * and the session is released afterwards
+ */
+void testCloseAfterSend()
+{
+	auto fixture = LoopFixture();
+
+	{
+		auto connection = lsp::Connection(fixture.client());
+		auto handler    = lsp::MessageHandler(connection);
+
+		for(int i = 0; i < 10; ++i)
+			handler.sendNotification("count");
+	}
+
+	fixture.client().close();
+
+	LSP_CHECK(waitFor([&](){ return fixture.notificationCount() == 10; }));
+	LSP_CHECK(waitFor([&](){ return fixture.loop().sessionCount() == 0; }));
+}
+
+} // namespace
+
+int main()
+{
+	// Writing to a closed peer must fail instead of ending the process
+	std::signal(SIGPIPE, SIG_IGN);
+
+	testRoundTrip();
+	testHalfClose();
+	testCloseAfterSend();
+
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int main()
+{
+	return 0;
+}
+
+#endif // LSP_EVENTLOOP_UNSUPPORTED
@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <limits>
+#include <lsp/metrics.h>
+#include "test.h"
+
+namespace{
+
+using lsp::Histogram;
+
+/*
+ * Every value has to fall into the bucket whose range contains it
+ */
+void testBucketBounds()
+{
+	// Values below SubBucketCount have a bucket each
+	for(std::uint64_t value = 0; value < Histogram::SubBucketCount; ++value)
+	{
+		LSP_CHECK(Histogram::bucketIndex(value) == value);
+		LSP_CHECK(Histogram::bucketUpperBound(value) == value);
+	}
+
+	// Adjacent buckets cover consecutive ranges
+	for(std::size_t index = 0; index + 1 < Histogram::BucketCount; ++index)
+	{
+		const auto upper = Histogram::bucketUpperBound(index);
+
+		LSP_CHECK(Histogram::bucketIndex(upper) == index);
+		LSP_CHECK(Histogram::bucketIndex(upper + 1) == index + 1);
+		LSP_CHECK(Histogram::bucketUpperBound(index + 1) > upper);
+	}
+
+	const auto max = std::numeric_limits<std::uint64_t>::max();
+	LSP_CHECK(Histogram::bucketIndex(max) == Histogram::BucketCount - 1);
+	LSP_CHECK(Histogram::bucketUpperBound(Histogram::BucketCount - 1) == max);
+}
+
+/*
+ * The bucket width relative to its values is bounded by the number of sub buckets
+ */
+void testRelativeError()
+{
+	for(unsigned int exponent = Histogram::SubBucketBits; exponent < 64; ++exponent)
+	{
+		for(const auto offset : {std::uint64_t(0), std::uint64_t(1), std::uint64_t(12345)})
+		{
+			const auto value = (std::uint64_t(1) << exponent) + offset;
+			const auto upper = Histogram::bucketUpperBound(Histogram::bucketIndex(value));
+
+			LSP_CHECK(upper >= value);
+			LSP_CHECK(upper - value <= value / Histogram::SubBucketCount);
+		}
+	}
+}
+
+void testSnapshot()
+{
+	auto histogram = Histogram();
+
+	for(std::uint64_t value = 1; value <= 100; ++value)
+		histogram.record(value);
+
+	const auto snapshot = histogram.snapshot();
+	LSP_CHECK(snapshot.count == 100);
+	LSP_CHECK(snapshot.sum == 5050);
+	LSP_CHECK(snapshot.max == 100);
+	LSP_CHECK(snapshot.buckets.size() == Histogram::bucketIndex(100) + 1);
+	LSP_CHECK(snapshot.percentile(0) == 1);
+	LSP_CHECK(snapshot.percentile(100) == 100);
+
+	// Percentiles report the upper bound of the bucket the rank falls into
+	const auto median = snapshot.percentile(50);
+	LSP_CHECK(median >= 50);
+	LSP_CHECK(median == Histogram::bucketUpperBound(Histogram::bucketIndex(50)));
+}
+
+void testEmptySnapshot()
+{
+	const auto snapshot = Histogram().snapshot();
+	LSP_CHECK(snapshot.count == 0);
+	LSP_CHECK(snapshot.buckets.empty());
+	LSP_CHECK(snapshot.percentile(99) == 0);
+	LSP_CHECK(snapshot.mean() == 0.0);
+}
+
+} // namespace
+
+int main()
+{
+	testBucketBounds();
+	testRelativeError();
+	testSnapshot();
+	testEmptySnapshot();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <lsp/connection.h>
+#include <lsp/messagehandler.h>
+#include <lsp/promise.h>
+#include <lsp/io/stream.h>
+#include "test.h"
+
+namespace{
+
+/*
+ * Reads from a fixed input and collects everything that is written
+ */
+class MemoryStream : public lsp::io::Stream{
+public:
+	explicit MemoryStream(std::string input)
+		: m_input{std::move(input)}
+	{
+	}
+
+	void read(char* buffer, std::size_t size) override
+	{
+		if(m_input.size() - m_readPosition < size)
+			throw lsp::io::Error("End of input");
+
+		std::memcpy(buffer, m_input.data() + m_readPosition, size);
+		m_readPosition += size;
+	}
+
+	void write(const char* buffer, std::size_t size) override
+	{
+		const auto lock = std::lock_guard(m_outputMutex);
+		m_output.append(buffer, size);
+	}
+
+	std::string output() const
+	{
+		const auto lock = std::lock_guard(m_outputMutex);
+		return m_output;
+	}
+
+private:
+	std::string        m_input;
+	std::size_t        m_readPosition = 0;
+	mutable std::mutex m_outputMutex;
+	std::string        m_output;
+};
+
+std::string frameRequest(const std::string& method, int id)
+{
+	const auto content = R"({"jsonrpc":"2.0","id":)" + std::to_string(id) + R"(,"method":")" + method + R"(","params":[]})";
+	return "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+}
+
+/*
+ * Receives a request whose handler returns a promise and keeps the promise for the test
+ */
+struct PromiseFixture{
+	MemoryStream                                                          stream{frameRequest("promise", 1)};
+	lsp::Connection                                                       connection{stream};
+	std::optional<lsp::MessageHandler>                                    handler{std::in_place, connection};
+	std::optional<lsp::RequestPromise<lsp::MessageHandler::GenericMessage>> promise;
+
+	PromiseFixture()
+	{
+		handler->add("promise", lsp::MessageHandler::GenericPromiseMessageCallback([this](lsp::json::Value&&)
+		{
+			promise.emplace();
+			return *promise;
+		}));
+
+		handler->processIncomingMessages();
+		LSP_CHECK(promise.has_value());
+	}
+};
+
+/*
+ * The response is sent on the thread that fulfills the promise
+ */
+void testFulfill()
+{
+	auto fixture = PromiseFixture();
+
+	LSP_CHECK(fixture.stream.output().empty());
+	fixture.promise->setValue(lsp::json::String("result"));
+	LSP_CHECK(fixture.stream.output().find("\"result\"") != std::string::npos);
+}
+
+/*
+ * A promise that is fulfilled after its handler was destroyed does not use the handler anymore
+ */
+void testFulfillAfterHandlerDestroyed()
+{
+	auto fixture = PromiseFixture();
+
+	fixture.handler.reset();
+	fixture.promise->setValue(lsp::json::String("result"));
+	LSP_CHECK(fixture.stream.output().empty());
+}
+
+/*
+ * Same for a promise that is destroyed without being fulfilled, which would otherwise send an error response
+ */
+void testDestroyAfterHandlerDestroyed()
+{
+	auto fixture = PromiseFixture();
+
+	fixture.handler.reset();
+	fixture.promise.reset();
+	LSP_CHECK(fixture.stream.output().empty());
+}
+
+} // namespace
+
+int main()
+{
+	testFulfill();
+	testFulfillAfterHandlerDestroyed();
+	testDestroyAfterHandlerDestroyed();
+
+	return EXIT_SUCCESS;
+}
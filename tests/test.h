@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+/*
+ * The tests are plain executables that are registered with CTest.
+ * A failed check reports the expression and ends the test with a non-zero exit code.
+ */
+
+#define LSP_CHECK(condition)                                                               \
+	do{                                                                                    \
+		if(!(condition))                                                                   \
+		{                                                                                  \
+			std::cerr << __FILE__ << ':' << __LINE__ << ": Check failed: " #condition "\n"; \
+			std::exit(EXIT_FAILURE);                                                       \
+		}                                                                                  \
+	}while(false)
@@ -0,0 +1,117 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <lsp/threadpool.h>
+#include "test.h"
+
+namespace{
+
+constexpr unsigned int ThreadCount = 8;
+
+/*
+ * Tasks posted from inside of a task are pushed to the deque of its worker. The worker pops them
+ * from the bottom while the other workers steal them from the top, which also grows the deque.
+ * Every task has to run exactly once.
+ */
+void testPushPopSteal()
+{
+	constexpr std::size_t TaskCount = 200000;
+
+	auto pool = lsp::ThreadPool(lsp::ThreadPoolOptions{.minThreads = ThreadCount, .maxThreads = ThreadCount});
+	auto runs = std::make_unique<std::atomic<unsigned int>[]>(TaskCount);
+
+	pool.post([&pool, &runs]()
+	{
+		for(std::size_t i = 0; i < TaskCount; ++i)
+			pool.post([&runs, i](){ runs[i].fetch_add(1, std::memory_order_relaxed); });
+	});
+
+	pool.drain().wait();
+
+	for(std::size_t i = 0; i < TaskCount; ++i)
+		LSP_CHECK(runs[i].load() == 1);
+}
+
+/*
+ * Every task spawns two children so all workers push, pop and steal at the same time
+ */
+void testRecursiveSpawn()
+{
+	constexpr unsigned int Depth = 16;
+
+	struct Spawner{
+		lsp::ThreadPool&          pool;
+		std::atomic<std::size_t>& count;
+		unsigned int              depth;
+
+		void operator()() const
+		{
+			count.fetch_add(1, std::memory_order_relaxed);
+
+			if(depth == 0)
+				return;
+
+			pool.post(Spawner{pool, count, depth - 1});
+			pool.post(Spawner{pool, count, depth - 1});
+		}
+	};
+
+	auto pool  = lsp::ThreadPool(lsp::ThreadPoolOptions{.minThreads = ThreadCount, .maxThreads = ThreadCount});
+	auto count = std::atomic<std::size_t>(0);
+
+	pool.post(Spawner{pool, count, Depth});
+	pool.drain().wait();
+
+	LSP_CHECK(count.load() == (std::size_t(1) << (Depth + 1)) - 1);
+}
+
+/*
+ * Tasks from several threads outside of the pool go through the injection queue and spawn
+ * tasks of every priority on the workers while they are being stolen
+ */
+void testConcurrentProducers()
+{
+	constexpr unsigned int ProducerCount    = 4;
+	constexpr std::size_t  TasksPerProducer = 20000;
+
+	auto pool      = lsp::ThreadPool(lsp::ThreadPoolOptions{.minThreads = ThreadCount, .maxThreads = ThreadCount});
+	auto count     = std::atomic<std::size_t>(0);
+	auto producers = std::vector<std::thread>();
+
+	for(unsigned int p = 0; p < ProducerCount; ++p)
+	{
+		producers.emplace_back([&pool, &count]()
+		{
+			for(std::size_t i = 0; i < TasksPerProducer; ++i)
+			{
+				const auto priority = static_cast<lsp::TaskPriority>(i % 3);
+
+				pool.post(priority, [&pool, &count, priority]()
+				{
+					count.fetch_add(1, std::memory_order_relaxed);
+					pool.post(priority, [&count](){ count.fetch_add(1, std::memory_order_relaxed); });
+				});
+			}
+		});
+	}
+
+	for(auto& producer : producers)
+		producer.join();
+
+	pool.drain().wait();
+
+	LSP_CHECK(count.load() == 2 * ProducerCount * TasksPerProducer);
+	LSP_CHECK(pool.stats().queuedTaskCount == 0);
+}
+
+} // namespace
+
+int main()
+{
+	testPushPopSteal();
+	testRecursiveSpawn();
+	testConcurrentProducers();
+
+	return EXIT_SUCCESS;
+}
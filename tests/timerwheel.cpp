@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <lsp/timerwheel.h>
+#include "test.h"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace{
+
+/*
+ * Timers whose delays cross the slot and level boundaries of the wheel
+ */
+void testLevelRollover()
+{
+	// With a 1ms tick a level 0 slot is 1ms, a level 1 slot 64ms and a level 2 slot 4096ms
+	const auto delays = std::vector<std::chrono::milliseconds>{
+		0ms, 1ms, 2ms, 62ms, 63ms, 64ms, 65ms, 127ms, 128ms, 129ms, 500ms, 4095ms, 4096ms, 4097ms, 4200ms
+	};
+
+	struct Expiry{
+		std::chrono::milliseconds delay;
+		Clock::time_point         time;
+	};
+
+	auto       wheel    = lsp::TimerWheel(1ms);
+	auto       mutex    = std::mutex();
+	auto       expiries = std::vector<Expiry>();
+	const auto start    = Clock::now();
+
+	for(const auto delay : delays)
+	{
+		wheel.schedule(delay, [&mutex, &expiries, delay]()
+		{
+			const auto lock = std::lock_guard(mutex);
+			expiries.push_back({delay, Clock::now()});
+		});
+	}
+
+	while(wheel.activeTimerCount() > 0)
+		std::this_thread::sleep_for(10ms);
+
+	const auto lock = std::lock_guard(mutex);
+	LSP_CHECK(expiries.size() == delays.size());
+
+	for(std::size_t i = 0; i < expiries.size(); ++i)
+	{
+		// Never early and in the order of their delays
+		LSP_CHECK(expiries[i].time - start >= expiries[i].delay);
+		LSP_CHECK(expiries[i].time - start < expiries[i].delay + 500ms);
+
+		if(i > 0)
+			LSP_CHECK(expiries[i - 1].delay <= expiries[i].delay);
+	}
+}
+
+/*
+ * Timers that are scheduled while the wheel is running are inserted relative to its current position
+ */
+void testScheduleWhileRunning()
+{
+	auto wheel = lsp::TimerWheel(1ms);
+	auto count = std::atomic<int>(0);
+
+	for(int i = 0; i < 20; ++i)
+	{
+		const auto scheduled = Clock::now();
+		const auto delay     = std::chrono::milliseconds(60 + i % 8);
+		auto       expired   = std::atomic<bool>(false);
+		auto       tooEarly  = std::atomic<bool>(false);
+
+		wheel.schedule(delay, [&, scheduled, delay]()
+		{
+			tooEarly = Clock::now() - scheduled < delay;
+			++count;
+			expired = true;
+		});
+
+		while(!expired)
+			std::this_thread::sleep_for(1ms);
+
+		LSP_CHECK(!tooEarly);
+	}
+
+	LSP_CHECK(count == 20);
+}
+
+void testCancel()
+{
+	auto wheel = lsp::TimerWheel(1ms);
+	auto fired = std::atomic<int>(0);
+
+	const auto near = wheel.schedule(30ms, [&fired](){ ++fired; });
+	const auto far  = wheel.schedule(100ms, [&fired](){ fired += 10; });
+
+	LSP_CHECK(wheel.cancel(far));
+	LSP_CHECK(!wheel.cancel(far));
+
+	while(wheel.activeTimerCount() > 0)
+		std::this_thread::sleep_for(5ms);
+
+	std::this_thread::sleep_for(150ms);
+	LSP_CHECK(fired == 1);
+	LSP_CHECK(!wheel.cancel(near));
+}
+
+void testPeriodic()
+{
+	auto wheel = lsp::TimerWheel(1ms);
+	auto runs  = std::atomic<int>(0);
+
+	const auto start = Clock::now();
+	const auto id    = wheel.schedulePeriodic(20ms, [&runs](){ ++runs; });
+
+	while(runs < 5)
+		std::this_thread::sleep_for(1ms);
+
+	LSP_CHECK(Clock::now() - start >= 100ms);
+	LSP_CHECK(wheel.cancel(id));
+	LSP_CHECK(wheel.activeTimerCount() == 0);
+}
+
+} // namespace
+
+int main()
+{
+	testLevelRollover();
+	testScheduleWhileRunning();
+	testCancel();
+	testPeriodic();
+
+	return EXIT_SUCCESS;
+}